@@ -0,0 +1,460 @@
+/// @file
+///	@ingroup   weft
+///	@copyright Copyright 2020 Stephen Meyer. All rights reserved.
+///	@licence	     Use of this source code is governed by the MIT License found in the License.md file.
+
+// Benchmark suite for the weft transforms.
+//
+// Times the work each object does on bang (size the output, run the transform) for every transform,
+// over sequence sizes from 8 to 1M steps and several pattern shapes. Reports ns per output element,
+// heap allocations per bang and the process peak RSS, as a table or as JSON for comparing builds.
+//
+// Usage: weft.bench [--json <file>|-] [--filter <text>] [--max-size <n>] [--min-time <ms>]
+
+#include "weft_chain.h"
+#include "weft_core.h"
+#include "weft_parallel.h"
+#include "weft_plan.h"
+#include "weft_simd.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <new>
+#include <random>
+#include <string>
+#include <vector>
+
+#if defined(_WIN32)
+    #include <windows.h>
+    #include <psapi.h>
+#else
+    #include <sys/resource.h>
+#endif
+
+
+// Allocation counting. Every global allocation in the process goes through these replacements.
+static std::atomic<size_t> allocation_count {0};
+static std::atomic<size_t> allocation_bytes {0};
+
+
+static void* counted_alloc(size_t size) {
+    allocation_count.fetch_add(1, std::memory_order_relaxed);
+    allocation_bytes.fetch_add(size, std::memory_order_relaxed);
+    if (void* ptr = std::malloc(size ? size : 1))
+        return ptr;
+    throw std::bad_alloc();
+}
+
+
+void* operator new(size_t size)                                  { return counted_alloc(size); }
+void* operator new[](size_t size)                                { return counted_alloc(size); }
+void* operator new(size_t size, const std::nothrow_t&) noexcept   { try { return counted_alloc(size); } catch (...) { return nullptr; } }
+void* operator new[](size_t size, const std::nothrow_t&) noexcept { try { return counted_alloc(size); } catch (...) { return nullptr; } }
+void  operator delete(void* ptr) noexcept                         { std::free(ptr); }
+void  operator delete[](void* ptr) noexcept                       { std::free(ptr); }
+void  operator delete(void* ptr, size_t) noexcept                 { std::free(ptr); }
+void  operator delete[](void* ptr, size_t) noexcept               { std::free(ptr); }
+
+
+static size_t peak_rss_bytes() {
+#if defined(_WIN32)
+    PROCESS_MEMORY_COUNTERS counters;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+        return counters.PeakWorkingSetSize;
+    return 0;
+#else
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    #if defined(__APPLE__)
+        return usage.ru_maxrss;
+    #else
+        return size_t(usage.ru_maxrss) * 1024;
+    #endif
+#endif
+}
+
+
+// A single transform bang over prepared inputs. Returns the number of output steps.
+using bang_function = std::function<size_t(const std::vector<int32_t>&, const std::vector<int32_t>&)>;
+
+
+struct transform_case {
+    std::string   name;
+    bang_function bang;
+    // Output length for a given input, used to skip cases that would not fit in memory.
+    std::function<size_t(const std::vector<int32_t>&, const std::vector<int32_t>&)> length;
+    std::vector<size_t> sizes = { 8, 64, 512, 4096, 32768, 262144, 1048576 };
+};
+
+
+struct pattern_shape {
+    std::string          name;
+    std::vector<int32_t> pattern;
+};
+
+
+struct result {
+    std::string transform;
+    std::string shape;
+    size_t      input_size;
+    size_t      output_size;
+    size_t      iterations;
+    double      ns_per_bang;
+    double      ns_per_element;
+    double      allocations_per_bang;
+    double      bytes_per_bang;
+    size_t      peak_rss;
+};
+
+
+// Like the externals, every case writes into one output buffer kept between bangs, which only
+// allocates when it has to grow, so steady-state bangs count no allocations.
+static std::span<int32_t> output_buffer(size_t length) {
+    static std::vector<int32_t> buffer;
+    buffer.resize(length);
+    return buffer;
+}
+
+
+// The bang paths mirror the externals: size an output buffer from the matching length function,
+// then gather it through the transform's cached index plan, or run the transform into it where the
+// transform has no plan. The ".direct" cases always run the transform, the ".scalar" cases run the
+// vectorized transforms on their scalar kernels, and the ".parallel" cases run the transform on
+// every hardware thread, for comparison.
+static std::vector<transform_case> transform_cases() {
+    using seq_t = const std::vector<int32_t>&;
+
+    // The pattern of melody XV, when given, is its period and base.
+    auto shape_of = [](seq_t pattern) {
+        return pattern.size() == 2 ? weft::xv_shape { size_t(pattern[0]), size_t(pattern[1]) } : weft::xv_shape {};
+    };
+
+    auto melody = [=](std::string name, weft::melody which) {
+        return transform_case {
+            name,
+            [=](seq_t seq, seq_t pattern) {
+                std::span<int32_t> out = output_buffer(weft::melody_length(which, seq.size(), shape_of(pattern)));
+                if (auto plan = weft::melody_plan(which, seq.size(), shape_of(pattern)))
+                    return weft::gather(seq, *plan, out);
+                return weft::apply_melody(which, seq, shape_of(pattern), out);
+            },
+            [=](seq_t seq, seq_t pattern) { return weft::melody_length(which, seq.size(), shape_of(pattern)); }
+        };
+    };
+
+    auto melody_direct = [=](std::string name, weft::melody which) {
+        transform_case direct = melody(name + ".direct", which);
+        direct.bang = [=](seq_t seq, seq_t pattern) {
+            std::span<int32_t> out = output_buffer(weft::melody_length(which, seq.size(), shape_of(pattern)));
+            return weft::apply_melody(which, seq, shape_of(pattern), out);
+        };
+        return direct;
+    };
+
+    auto melody_parallel = [=](std::string name, weft::melody which) {
+        transform_case parallel = melody(name + ".parallel", which);
+        parallel.bang = [=](seq_t seq, seq_t pattern) {
+            std::span<int32_t> out = output_buffer(weft::melody_length(which, seq.size(), shape_of(pattern)));
+            return weft::parallel_apply_melody(which, seq, shape_of(pattern), out, weft::hardware_threads());
+        };
+        return parallel;
+    };
+
+    // Melody XV's length depends only on its period, so a single small sequence is enough.
+    transform_case melody_xv = melody("rational.xv", weft::melody::xv);
+    transform_case melody_xv_direct = melody_direct("rational.xv", weft::melody::xv);
+    melody_xv.sizes = melody_xv_direct.sizes = { 8 };
+
+    // Melody XVI doubles its output with every input step, so it gets its own range of sizes.
+    transform_case melody_xvi = melody("rational.xvi", weft::melody::xvi);
+    transform_case melody_xvi_direct = melody_direct("rational.xvi", weft::melody::xvi);
+    melody_xvi.sizes = melody_xvi_direct.sizes = { 4, 8, 12, 16, 20, 24 };
+
+    // weft.chain's default stages, each given the same pattern.
+    static const std::vector<weft::stage> chain_stages = { weft::stage::rhythm, weft::stage::repeater, weft::stage::shifter, weft::stage::gates };
+
+    auto scalar = [](bang_function bang) {
+        return [=](seq_t seq, seq_t pattern) {
+            weft::set_simd_level(weft::simd_level::scalar);
+            size_t written = bang(seq, pattern);
+            weft::set_simd_level(weft::best_simd_level());
+            return written;
+        };
+    };
+
+    auto shifter = [](seq_t seq, seq_t pattern) {
+        std::span<int32_t> out = output_buffer(seq.size());
+        return weft::apply_shifts(seq, pattern, out);
+    };
+
+    auto gates = [](seq_t seq, seq_t pattern) {
+        std::span<int32_t> out = output_buffer(seq.size());
+        return weft::apply_gates(seq, pattern, out);
+    };
+
+    // The change from the sequence to the sequence shifted by the pattern, as @output delta finds
+    // the change from one output to the next. The shifted sequence is made once per shape.
+    auto delta = [](seq_t seq, seq_t pattern) {
+        static std::vector<int32_t> shifted;
+        static std::vector<int32_t> shifted_by;
+        static const int32_t*       shifted_from = nullptr;
+        static std::vector<size_t>  changed;
+
+        if (shifted_from != seq.data() || shifted.size() != seq.size() || shifted_by != pattern) {
+            shifted.resize(seq.size());
+            weft::apply_shifts(seq, pattern, shifted);
+            shifted_from = seq.data();
+            shifted_by   = pattern;
+        }
+
+        changed.clear();
+        weft::changed_steps(seq, shifted, changed);
+        return seq.size();
+    };
+
+    return {
+        { "rhythm",
+            [](seq_t seq, seq_t pattern) {
+                std::span<int32_t> out = output_buffer(weft::rhythm_length(seq, pattern, -1));
+                if (auto plan = weft::rhythm_plan(seq.size(), pattern, weft::fill_mode::wrap, -1))
+                    return weft::gather(seq, *plan, out);
+                return weft::apply_rhythm(seq, pattern, weft::fill_mode::wrap, out);
+            },
+            [](seq_t seq, seq_t pattern) { return weft::rhythm_length(seq, pattern, -1); }
+        },
+        { "rhythm.direct",
+            [](seq_t seq, seq_t pattern) {
+                std::span<int32_t> out = output_buffer(weft::rhythm_length(seq, pattern, -1));
+                return weft::apply_rhythm(seq, pattern, weft::fill_mode::wrap, out);
+            },
+            [](seq_t seq, seq_t pattern) { return weft::rhythm_length(seq, pattern, -1); }
+        },
+        { "rhythm.parallel",
+            [](seq_t seq, seq_t pattern) {
+                std::span<int32_t> out = output_buffer(weft::rhythm_length(seq, pattern, -1));
+                return weft::parallel_apply_rhythm(seq, pattern, weft::fill_mode::wrap, out, weft::hardware_threads());
+            },
+            [](seq_t seq, seq_t pattern) { return weft::rhythm_length(seq, pattern, -1); }
+        },
+        { "repeater",
+            [](seq_t seq, seq_t pattern) {
+                std::span<int32_t> out = output_buffer(weft::repeats_length(seq, pattern));
+                if (auto plan = weft::repeats_plan(seq.size(), pattern))
+                    return weft::gather(seq, *plan, out);
+                return weft::apply_repeats(seq, pattern, out);
+            },
+            [](seq_t seq, seq_t pattern) { return weft::repeats_length(seq, pattern); }
+        },
+        { "repeater.direct",
+            [](seq_t seq, seq_t pattern) {
+                std::span<int32_t> out = output_buffer(weft::repeats_length(seq, pattern));
+                return weft::apply_repeats(seq, pattern, out);
+            },
+            [](seq_t seq, seq_t pattern) { return weft::repeats_length(seq, pattern); }
+        },
+        { "shifter",        shifter,         [](seq_t seq, seq_t) { return seq.size(); } },
+        { "shifter.scalar", scalar(shifter), [](seq_t seq, seq_t) { return seq.size(); } },
+        { "gates",          gates,           [](seq_t seq, seq_t) { return seq.size(); } },
+        { "gates.scalar",   scalar(gates),   [](seq_t seq, seq_t) { return seq.size(); } },
+        { "delta",          delta,           [](seq_t seq, seq_t) { return seq.size(); } },
+        { "delta.scalar",   scalar(delta),   [](seq_t seq, seq_t) { return seq.size(); } },
+        { "chain",
+            [=](seq_t seq, seq_t pattern) {
+                // Like weft.chain, keep its own buffers between bangs.
+                static std::vector<int32_t> out, scratch;
+                return weft::run_chain(seq, chain_stages, { pattern, pattern, pattern, pattern }, out, scratch);
+            },
+            [=](seq_t seq, seq_t pattern) { return weft::chain_length(seq.size(), chain_stages, { pattern, pattern, pattern, pattern }); }
+        },
+        melody("rational.iv", weft::melody::iv),
+        melody_direct("rational.iv", weft::melody::iv),
+        melody_parallel("rational.iv", weft::melody::iv),
+        melody("rational.xi", weft::melody::xi),
+        melody_direct("rational.xi", weft::melody::xi),
+        melody_parallel("rational.xi", weft::melody::xi),
+        melody_xv,
+        melody_xv_direct,
+        melody_xvi,
+        melody_xvi_direct,
+    };
+}
+
+
+static std::vector<int32_t> random_pattern(std::mt19937& rng, size_t size, int32_t low, int32_t high) {
+    std::uniform_int_distribution<int32_t> values(low, high);
+    std::vector<int32_t> pattern(size);
+    for (auto& step : pattern)
+        step = values(rng);
+    return pattern;
+}
+
+
+// Pattern shapes per transform. The rational melodies take no pattern, apart from melody XV's shape.
+// The ".direct", ".scalar" and ".parallel" cases share the shapes of their transform.
+static std::vector<pattern_shape> pattern_shapes(std::string transform, std::mt19937& rng) {
+    for (const char* variant : { ".direct", ".scalar", ".parallel" })
+        if (transform.ends_with(variant))
+            transform.resize(transform.size() - std::strlen(variant));
+
+    if (transform == "rhythm")
+        return { {"dense", {1}}, {"sparse", {1, 0, 0, 0}}, {"mixed", {1, 1, 0, 1, 0}}, {"random64", random_pattern(rng, 64, 0, 1)} };
+    else if (transform == "repeater")
+        return { {"identity", {1}}, {"mixed", {2, 1, 0, 3}}, {"random64", random_pattern(rng, 64, 0, 4)} };
+    else if (transform == "shifter")
+        return { {"zero", {0}}, {"mixed", {12, -12, 7}}, {"random61", random_pattern(rng, 61, -12, 12)} };
+    else if (transform == "delta") {
+        // Shifting every 64th step changes about one step in 64; shifting every step changes all
+        // but the rests.
+        std::vector<int32_t> every_64th(64, 0);
+        every_64th.back() = 1;
+        return { {"unchanged", {0}}, {"sparse", every_64th}, {"dense", {1}} };
+    }
+    else if (transform == "gates")
+        return { {"open", {1}}, {"mixed", {1, 0, 0}}, {"random64", random_pattern(rng, 64, 0, 1)} };
+    else if (transform == "chain")
+        return { {"mixed", {1, 1, 0, 2}}, {"random64", random_pattern(rng, 64, 0, 2)} };
+    else if (transform == "rational.xv")
+        return { {"p63b2", {63, 2}}, {"p4095b2", {4095, 2}}, {"p59049b2", {59049, 2}}, {"p1048573b3", {1048573, 3}} };
+    else
+        return { {"none", {}} };
+}
+
+
+static result run_case(const transform_case& transform, const pattern_shape& shape, const std::vector<int32_t>& seq, double min_time_ms) {
+    using clock = std::chrono::steady_clock;
+
+    // Warm up, and find the output size.
+    size_t output_size = transform.bang(seq, shape.pattern);
+
+    size_t iterations   = 0;
+    size_t allocations  = allocation_count.load();
+    size_t bytes        = allocation_bytes.load();
+    auto   start        = clock::now();
+    auto   elapsed      = clock::duration::zero();
+
+    do {
+        transform.bang(seq, shape.pattern);
+        iterations++;
+        elapsed = clock::now() - start;
+    } while (std::chrono::duration<double, std::milli>(elapsed).count() < min_time_ms);
+
+    allocations = allocation_count.load() - allocations;
+    bytes       = allocation_bytes.load() - bytes;
+
+    double ns_per_bang = std::chrono::duration<double, std::nano>(elapsed).count() / iterations;
+
+    return {
+        transform.name,
+        shape.name,
+        seq.size(),
+        output_size,
+        iterations,
+        ns_per_bang,
+        output_size ? ns_per_bang / output_size : 0.0,
+        double(allocations) / iterations,
+        double(bytes) / iterations,
+        peak_rss_bytes()
+    };
+}
+
+
+static void write_json(FILE* file, const std::vector<result>& results) {
+    std::fprintf(file, "{\n");
+    std::fprintf(file, "  \"build\": { \"type\": \"%s\", \"compiler\": \"%s\", \"simd\": \"%s\", \"threads\": %u },\n",
+        WEFT_BENCH_BUILD_TYPE, WEFT_BENCH_COMPILER, weft::simd_level_name(weft::best_simd_level()), weft::hardware_threads());
+    std::fprintf(file, "  \"results\": [\n");
+    for (size_t i = 0; i < results.size(); i++) {
+        const result& r = results[i];
+        std::fprintf(file,
+            "    { \"transform\": \"%s\", \"shape\": \"%s\", \"input_size\": %zu, \"output_size\": %zu, \"iterations\": %zu, "
+            "\"ns_per_bang\": %.1f, \"ns_per_element\": %.4f, \"allocations_per_bang\": %.2f, \"bytes_per_bang\": %.0f, \"peak_rss_bytes\": %zu }%s\n",
+            r.transform.c_str(), r.shape.c_str(), r.input_size, r.output_size, r.iterations,
+            r.ns_per_bang, r.ns_per_element, r.allocations_per_bang, r.bytes_per_bang, r.peak_rss,
+            i + 1 < results.size() ? "," : "");
+    }
+    std::fprintf(file, "  ]\n}\n");
+}
+
+
+static void write_table(FILE* file, const std::vector<result>& results) {
+    std::fprintf(file, "%-20s %-10s %10s %12s %14s %10s %10s %10s\n",
+        "transform", "shape", "input", "output", "ns/bang", "ns/elem", "allocs", "rss MB");
+    for (const result& r : results)
+        std::fprintf(file, "%-20s %-10s %10zu %12zu %14.1f %10.3f %10.2f %10.1f\n",
+            r.transform.c_str(), r.shape.c_str(), r.input_size, r.output_size,
+            r.ns_per_bang, r.ns_per_element, r.allocations_per_bang, r.peak_rss / (1024.0 * 1024.0));
+}
+
+
+int main(int argc, char* argv[]) {
+    const char* json_path   = nullptr;
+    std::string filter;
+    size_t      max_size    = 1 << 20;
+    double      min_time_ms = 50.0;
+
+    // Cases whose output would exceed this many steps are skipped.
+    const size_t max_output_size = size_t(1) << 26;
+
+    for (int i = 1; i < argc; i++) {
+        if (!std::strcmp(argv[i], "--json") && i + 1 < argc)
+            json_path = argv[++i];
+        else if (!std::strcmp(argv[i], "--filter") && i + 1 < argc)
+            filter = argv[++i];
+        else if (!std::strcmp(argv[i], "--max-size") && i + 1 < argc)
+            max_size = std::strtoull(argv[++i], nullptr, 10);
+        else if (!std::strcmp(argv[i], "--min-time") && i + 1 < argc)
+            min_time_ms = std::strtod(argv[++i], nullptr);
+        else {
+            std::fprintf(stderr, "usage: %s [--json <file>|-] [--filter <text>] [--max-size <n>] [--min-time <ms>]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    std::mt19937         rng(20200101);
+    std::vector<result>  results;
+
+    for (const transform_case& transform : transform_cases()) {
+        if (!filter.empty() && transform.name.find(filter) == std::string::npos)
+            continue;
+
+        for (const pattern_shape& shape : pattern_shapes(transform.name, rng)) {
+            for (size_t size : transform.sizes) {
+                if (size > max_size)
+                    break;
+
+                // Note values with occasional rests, as in a real sequence.
+                std::vector<int32_t> seq = random_pattern(rng, size, 0, 127);
+                for (size_t i = 0; i < seq.size(); i += 7)
+                    seq[i] = 0;
+
+                if (transform.length(seq, shape.pattern) > max_output_size)
+                    break;
+
+                results.push_back(run_case(transform, shape, seq, min_time_ms));
+                if (!json_path || std::strcmp(json_path, "-"))
+                    std::fprintf(stderr, "%s/%s/%zu\n", transform.name.c_str(), shape.name.c_str(), size);
+            }
+        }
+    }
+
+    if (json_path && !std::strcmp(json_path, "-"))
+        write_json(stdout, results);
+    else {
+        write_table(stdout, results);
+        if (json_path) {
+            FILE* file = std::fopen(json_path, "w");
+            if (!file) {
+                std::fprintf(stderr, "could not open %s for writing\n", json_path);
+                return 1;
+            }
+            write_json(file, results);
+            std::fclose(file);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,424 @@
+/// @file
+///	@ingroup   weft
+///	@copyright Copyright 2020 Stephen Meyer. All rights reserved.
+///	@licence	     Use of this source code is governed by the MIT License found in the License.md file.
+
+#include "c74_min.h"
+#include "../weft.shared/weft.h"
+
+using namespace c74::min;
+
+
+class chain : public sequence_object<chain> {
+public:
+    MIN_DESCRIPTION {"Transform a sequence by a chain of weft transforms in a single pass."};
+    MIN_TAGS        {"sequences, transformations"};
+    MIN_AUTHOR      {"Steve Meyer"};
+    MIN_RELATED     {"weft.rhythm, weft.repeater, weft.shifter, weft.gates"};
+
+
+    inlet<>       input        { this, "(bang) send out transformed sequence" };
+    traced_outlet output       { this, "weft.chain output", "(list) the transformed sequence as a list." };
+    traced_outlet info_output  { this, "weft.chain info_output", "(list) the length of the transformed sequence, in reply to getlength." };
+    traced_outlet stats_output { this, "weft.chain stats_output", "(dictionary) performance statistics, in reply to stats." };
+
+
+private:
+    friend class sequence_object<chain>;
+
+    static constexpr const char* class_name = "weft.chain";
+
+    // Everything the chain depends on, published as a whole whenever an attribute changes so that
+    // bang never waits on a setter. The transformed sequence is computed at most once per state.
+    struct state {
+        std::vector<weft::stage> stages     { weft::stage::rhythm, weft::stage::repeater, weft::stage::shifter, weft::stage::gates };
+        shared_steps             sequence   { make_steps({0}) };
+        shared_steps             rhythm     { make_steps({1}) };
+        shared_steps             repeats    { make_steps({1}) };
+        shared_steps             shifts     { make_steps({0}) };
+        shared_steps             gates      { make_steps({1}) };
+        int                      length     { -1 };
+        weft::fill_mode          mode       { weft::fill_mode::wrap };
+        size_t                   max_output { to_output_limit(default_max_output) };
+        overflow_action          overflow   { overflow_action::refuse };
+
+        lazy<atoms>              output;
+    };
+
+    snapshot<state> m_state { state {} };
+
+    // Counters for the stats message, recorded by bang.
+    bang_stats m_stats;
+
+    // The output last sent, for @output delta.
+    output_delta m_delta;
+
+    // Where edited sequence steps land in the output, kept between edits.
+    edit_positions m_edit_positions;
+
+    // The buffers bang runs the chain in before its output becomes atoms.
+    step_buffer m_output_seq;
+    step_buffer m_scratch_seq;
+
+
+public:
+    attribute< vector<symbol> > stages { this, "stages", {"rhythm", "repeater", "shifter", "gates"},
+        description {"The transforms to apply, in order: any of rhythm, repeater, shifter and gates."},
+        setter { MIN_FUNCTION {
+            trace_scope traced { "weft.chain stages" };
+            std::vector<weft::stage> parsed;
+            if (args.size() == 0 || !parse_stages(args, parsed))
+                return this->stages;
+            else {
+                m_state.update([&](state& s) { s.stages = parsed; });
+                return args;
+            }
+        }}
+    };
+
+
+    attribute< vector<int> > sequence { this, "sequence", {0}, description {"The primary sequence to transform."},
+        setter { MIN_FUNCTION {
+            trace_scope traced { "weft.chain sequence" };
+            shared_steps parsed;
+            if (args.size() == 0 || !parse_ints(args, parsed))
+                return this->sequence;
+            else {
+                m_state.update([&](state& s) { s.sequence = parsed; });
+                return args;
+            }
+        }},
+        getter { MIN_GETTER_FUNCTION { return state_steps(m_state, &state::sequence); }}
+    };
+
+
+    attribute< vector<int> > rhythm_pattern { this, "rhythm", {1}, description {"The rhythm pattern used by the rhythm stage."},
+        setter { MIN_FUNCTION {
+            trace_scope traced { "weft.chain rhythm" };
+            shared_steps parsed;
+            if (args.size() == 0 || !parse_ints(args, parsed))
+                return this->rhythm_pattern;
+            else {
+                m_state.update([&](state& s) { s.rhythm = parsed; });
+                return args;
+            }
+        }},
+        getter { MIN_GETTER_FUNCTION { return state_steps(m_state, &state::rhythm); }}
+    };
+
+
+    attribute<int> length { this, "length", -1, description {"The length of the rhythm stage's output in steps."},
+        setter { MIN_FUNCTION {
+            trace_scope traced { "weft.chain length" };
+            if (args.size() > 0)
+                m_state.update([&](state& s) { s.length = int(args[0]); });
+            return args;
+        }}
+    };
+
+
+    attribute<symbol> fill_mode { this, "fill_mode", "wrap",
+        description {"The mode used by the rhythm stage to fill out a sequence when the length is longer than the transformed sequence."},
+        range {"wrap", "silence"},
+        setter { MIN_FUNCTION {
+            trace_scope traced { "weft.chain fill_mode" };
+            if (args.size() > 0)
+                m_state.update([&](state& s) { s.mode = to_fill_mode(args[0]); });
+            return args;
+        }}
+    };
+
+
+    attribute< vector<int> > repeats_pattern { this, "repeats", {1}, description {"The repeats pattern used by the repeater stage."},
+        setter { MIN_FUNCTION {
+            trace_scope traced { "weft.chain repeats" };
+            shared_steps parsed;
+            if (args.size() == 0 || !parse_ints(args, parsed))
+                return this->repeats_pattern;
+            else {
+                m_state.update([&](state& s) { s.repeats = parsed; });
+                return args;
+            }
+        }},
+        getter { MIN_GETTER_FUNCTION { return state_steps(m_state, &state::repeats); }}
+    };
+
+
+    attribute< vector<int> > shift_pattern { this, "shift_pattern", {0}, description {"The shift pattern used by the shifter stage."},
+        setter { MIN_FUNCTION {
+            trace_scope traced { "weft.chain shift_pattern" };
+            shared_steps parsed;
+            if (args.size() == 0 || !parse_ints(args, parsed))
+                return this->shift_pattern;
+            else {
+                m_state.update([&](state& s) { s.shifts = parsed; });
+                return args;
+            }
+        }},
+        getter { MIN_GETTER_FUNCTION { return state_steps(m_state, &state::shifts); }}
+    };
+
+
+    attribute< vector<int> > gates_pattern { this, "gates", {1}, description {"The gates pattern used by the gates stage."},
+        setter { MIN_FUNCTION {
+            trace_scope traced { "weft.chain gates" };
+            shared_steps parsed;
+            if (args.size() == 0 || !parse_ints(args, parsed))
+                return this->gates_pattern;
+            else {
+                m_state.update([&](state& s) { s.gates = parsed; });
+                return args;
+            }
+        }},
+        getter { MIN_GETTER_FUNCTION { return state_steps(m_state, &state::gates); }}
+    };
+
+
+    message<> bang { this, "bang", "Send out the sequence transformed by every stage.",
+        MIN_FUNCTION {
+            trace_scope traced { "weft.chain bang" };
+            auto current = m_state.read();
+            bang_stats::scope timing { m_stats, current->sequence->size() };
+
+            if (bang_io(*current, timing))
+                return {};
+
+            size_t length = weft::chain_length(current->sequence->size(), current->stages, patterns(*current));
+
+            // Even with no max_output, an output too long to count can't be built.
+            if (length == weft::overflowed_length) {
+                cerr << "the transformed sequence is too long to compute, so it was not sent" << endl;
+                return {};
+            }
+
+            if (length > current->max_output && current->overflow != overflow_action::truncate) {
+                cerr << "the transformed sequence is longer than max_output, so it was not sent" << endl;
+                return {};
+            }
+
+            if (runs_async(async, std::min(length, current->max_output)))
+                m_background.submit([this, pending = timing.defer()] {
+                    auto current = m_state.read();
+                    transform(*current);
+                    return async_result<state> { std::move(current), pending };
+                }, cancel);
+            else {
+                const atoms& transformed_seq = transform(*current);
+                timing.output(transformed_seq.size());
+                send_output(output, transformed_seq, output_mode, m_delta);
+            }
+            return {};
+        }
+    };
+
+
+    message<> stats { this, "stats", "Send out the object's performance statistics as a dictionary from the rightmost outlet.",
+        MIN_FUNCTION {
+            send_stats(m_stats, stats_output);
+            return {};
+        }
+    };
+
+
+    message<> resetstats { this, "resetstats", "Clear the object's performance statistics.",
+        MIN_FUNCTION {
+            m_stats.reset();
+            return {};
+        }
+    };
+
+
+    message<> getlength { this, "getlength", "Send out the length of the transformed sequence from the middle outlet without computing it.",
+        MIN_FUNCTION {
+            auto current = m_state.read();
+
+            info_output.send("length", to_atom_length(weft::chain_length(current->sequence->size(), current->stages, patterns(*current))));
+            return {};
+        }
+    };
+
+
+    message<> setstep { this, "setstep", "Change one step of the sequence, given its index and new value. Unless the chain has a shifter stage, only the steps of the transformed sequence that play it are recomputed.",
+        MIN_FUNCTION {
+            trace_scope traced { "weft.chain setstep" };
+            long    index;
+            int32_t value;
+            if (!parse_edit(args, index, value) || !edit_steps(m_state, &state::sequence, index, value, [this](state& previous, const state& next, size_t step) { patch_sequence_edit(previous, next, step); }))
+                cerr << "setstep needs the index of a step in the sequence and its new value" << endl;
+            return {};
+        }
+    };
+
+
+    message<> setpattern { this, "setpattern", "Change one step of a stage's pattern, given the pattern's name (rhythm, repeats, shift_pattern or gates), the step's index and its new value. The transformed sequence is recomputed on the next bang.",
+        MIN_FUNCTION {
+            trace_scope traced { "weft.chain setpattern" };
+            shared_steps state::* pattern = args.size() == 3 ? pattern_named(args[0]) : nullptr;
+            long    index;
+            int32_t value;
+            if (!pattern || !parse_edit(atoms(args.begin() + 1, args.end()), index, value) || !edit_steps(m_state, pattern, index, value, [](state&, const state&, size_t) {}))
+                cerr << "setpattern needs the name of a pattern, the index of a step in it and its new value" << endl;
+            return {};
+        }
+    };
+
+
+    attribute<output_modes> output_mode { this, "output", output_modes::list, output_modes_range,
+        description {"How bang sends out the transformed sequence: as a list, or as delta, a message holding its length and an index and value for each step that changed since the last bang."},
+        setter { MIN_FUNCTION {
+            trace_scope traced { "weft.chain output" };
+            m_delta.reset();
+            return args;
+        }}
+    };
+
+
+    attribute<int> max_output { this, "max_output", default_max_output,
+        description {"The most steps a bang sends out, or 0 for no limit. The overflow attribute sets what happens to a longer output."},
+        setter { MIN_FUNCTION {
+            trace_scope traced { "weft.chain max_output" };
+            if (args.size() == 0 || int(args[0]) < 0)
+                return this->max_output;
+            else {
+                m_state.update([&](state& s) { s.max_output = to_output_limit(int(args[0])); });
+                return args;
+            }
+        }}
+    };
+
+
+    attribute<symbol> overflow { this, "overflow", "refuse",
+        description {"What bang does with an output longer than max_output: truncate it, or refuse to send it. A chain computes its stages over whole buffers, so it can't stream, and refuses instead."},
+        range {"truncate", "stream", "refuse"},
+        setter { MIN_FUNCTION {
+            trace_scope traced { "weft.chain overflow" };
+            if (args.size() > 0)
+                m_state.update([&](state& s) { s.overflow = to_overflow_action(args[0]); });
+            return args;
+        }}
+    };
+
+
+    attribute<async_modes> async { this, "async", async_modes::off, async_modes_range,
+        description {"Whether bang computes the transformed sequence on a background thread: off, on, or auto for long outputs only. The result is sent out once it is ready."}
+    };
+
+
+    attribute<bool> cancel { this, "cancel", true,
+        description {"With @async, drop any earlier result not yet sent out when the object is banged again."}
+    };
+
+
+    ~chain() {
+        m_background.stop();
+    }
+
+
+private:
+    // Length of one sequence of a batch or row of a matrix once transformed, cut short at max_output.
+    static size_t transformed_length(const state& current, size_t seq_size) {
+        return std::min(weft::chain_length(seq_size, current.stages, patterns(current)), current.max_output);
+    }
+
+
+    // One sequence of a batch or row of a matrix, transformed with the state's attributes into
+    // `out`, which holds transformed_length steps. The chain runs in buffers of its own, per
+    // thread as the pool's threads each run many sequences, and is copied into `out`.
+    static void transform_into(const state& current, std::span<const int32_t> seq, std::span<int32_t> out) {
+        thread_local steps chain_out;
+        thread_local steps chain_scratch;
+        // Cut short at out.size(), the chain gives exactly that many steps.
+        weft::run_chain(seq, current.stages, patterns(current), chain_out, chain_scratch, out.size());
+        std::copy(chain_out.begin(), chain_out.end(), out.begin());
+    }
+
+
+    // The patterns of every stage, as run_chain takes them.
+    static weft::chain_patterns patterns(const state& current) {
+        return { *current.rhythm, *current.repeats, *current.shifts, *current.gates, current.mode, current.length };
+    }
+
+    // A chain without a shifter stage only moves steps around, as the rhythm and repeater do, so
+    // an edit to the sequence changes only the output steps that play the edited step. A shifter
+    // stage makes each output step depend on the value too, so those chains rebuild on the next
+    // bang.
+    void patch_sequence_edit(state& previous, const state& next, size_t index) {
+        const atoms* output = previous.output.computed();
+        if (!output || weft::chain_length(next.sequence->size(), next.stages, patterns(next)) != output->size())
+            return;
+
+        if (auto plan = weft::chain_plan(next.sequence->size(), next.stages, patterns(next)))
+            patch_output(previous, next, m_edit_positions.of(plan, next.sequence->size(), index), (*next.sequence)[index]);
+    }
+
+    // The pattern setpattern names, by its attribute's name, or nullptr.
+    static shared_steps state::* pattern_named(const symbol& name) {
+        if (name == symbol("rhythm"))
+            return &state::rhythm;
+        if (name == symbol("repeats"))
+            return &state::repeats;
+        if (name == symbol("shift_pattern"))
+            return &state::shifts;
+        if (name == symbol("gates"))
+            return &state::gates;
+        return nullptr;
+    }
+
+    // The transformed sequence, cut short at max_output, computed at most once per state.
+    const atoms& transform(const state& current) {
+        return current.output.get([&] {
+            step_buffer::use output_use  { m_output_seq };
+            step_buffer::use scratch_use { m_scratch_seq };
+            steps&           chain_output  = *output_use;
+            steps&           chain_scratch = *scratch_use;
+
+            weft::run_chain(*current.sequence, current.stages, patterns(current), chain_output, chain_scratch, current.max_output);
+
+            atoms transformed_seq(chain_output.begin(), chain_output.end());
+            m_stats.record_allocation(transformed_seq.size() * sizeof(atom));
+            return transformed_seq;
+        });
+    }
+
+
+    // Sends out the results of asynchronous bangs on the scheduler thread.
+    timer<> deliverer { this, MIN_FUNCTION {
+        while (auto result = m_background.take()) {
+            const atoms& transformed_seq = transform(*result->current);
+            result->timing.output(m_stats, transformed_seq.size());
+            send_output(output, transformed_seq, output_mode, m_delta);
+        }
+        return {};
+    }};
+
+    background_worker<async_result<state>> m_background { [this] { deliverer.delay(0); } };
+
+
+    // Parse a list of stage names, leaving `parsed` unchanged and returning false if any is unknown.
+    static bool parse_stages(atoms const &args, std::vector<weft::stage> &parsed) {
+        std::vector<weft::stage> names;
+
+        for (const atom& arg : args) {
+            if (arg.a_type != c74::max::A_SYM)
+                return false;
+
+            symbol name = arg;
+            if (name == symbol("rhythm"))
+                names.push_back(weft::stage::rhythm);
+            else if (name == symbol("repeater"))
+                names.push_back(weft::stage::repeater);
+            else if (name == symbol("shifter"))
+                names.push_back(weft::stage::shifter);
+            else if (name == symbol("gates"))
+                names.push_back(weft::stage::gates);
+            else
+                return false;
+        }
+
+        parsed = std::move(names);
+        return true;
+    }
+};
+
+
+MIN_EXTERNAL(chain);
@@ -0,0 +1,128 @@
+/// @file
+/// @ingroup   weft
+/// @copyright Copyright 2020 Stephen Meyer. All rights reserved.
+/// @license        Use of this source code is governed by the MIT License found in the License.md file.
+
+#include "c74_min_unittest.h"  // required unit test header
+#include "weft.chain.cpp"   // need the source of our object so that we can access it
+
+
+SCENARIO("Object produces correct output") {
+    ext_main(nullptr);    // every unit test must call ext_main() once to configure the class
+
+    GIVEN("An instance of weft.chain with a sequence and a pattern for every stage") {
+
+        test_wrapper<chain> an_instance;
+        chain&             my_object = an_instance;
+        atoms sequence = {1, 2, 3};
+        atoms rhythm   = {1, 0};
+        atoms repeats  = {2, 1};
+        atoms shifts   = {10};
+        atoms gates    = {1, 0};
+        my_object.sequence = sequence;
+        my_object.rhythm_pattern = rhythm;
+        my_object.repeats_pattern = repeats;
+        my_object.shift_pattern = shifts;
+        my_object.gates_pattern = gates;
+
+        WHEN("it is banged with the default stages") {
+            my_object.bang();
+
+            THEN("it applies rhythm, repeater, shifter and gates in turn") {
+                auto& output = *c74::max::object_getoutput(my_object, 0);
+                atoms expected = {11, 0, 0, 0, 12, 0, 13, 0, 0};
+                REQUIRE(output.size() == 1);
+                REQUIRE(output[0] == expected);
+            }
+        }
+
+        WHEN("it is given fewer stages and it is banged") {
+            atoms stages = {"shifter", "gates"};
+            my_object.stages = stages;
+            my_object.bang();
+
+            THEN("it only applies those stages") {
+                auto& output = *c74::max::object_getoutput(my_object, 0);
+                atoms expected = {11, 0, 13};
+                REQUIRE(output.size() == 1);
+                REQUIRE(output[0] == expected);
+            }
+        }
+
+        WHEN("it is given an unknown stage and it is banged") {
+            atoms stages = {"repeater", "reverb"};
+            my_object.stages = stages;
+            my_object.bang();
+
+            THEN("the stages are not stored and the default chain is applied") {
+                auto& output = *c74::max::object_getoutput(my_object, 0);
+                atoms expected = {11, 0, 0, 0, 12, 0, 13, 0, 0};
+                REQUIRE(output.size() == 1);
+                REQUIRE(output[0] == expected);
+            }
+        }
+
+        WHEN("a long sequence is repeated into a shorter one and cut short at max_output") {
+            atoms long_sequence;
+            for (int i = 1; i <= 32; i++)
+                long_sequence.push_back(i);
+            atoms stages       = {"repeater"};
+            atoms drop_every_2 = {1, 0};
+            my_object.sequence = long_sequence;
+            my_object.stages = stages;
+            my_object.repeats_pattern = drop_every_2;
+            my_object.max_output = 12;
+            my_object.overflow = "truncate";
+            my_object.bang();
+
+            THEN("it sends the first max_output steps of the whole output") {
+                auto& output = *c74::max::object_getoutput(my_object, 0);
+                atoms expected = {1, 3, 5, 7, 9, 11, 13, 15, 17, 19, 21, 23};
+                REQUIRE(output.size() == 1);
+                REQUIRE(output[0] == expected);
+            }
+        }
+
+        WHEN("the stages are reordered and it is banged twice") {
+            atoms stages = {"gates", "repeater"};
+            my_object.stages = stages;
+            my_object.bang();
+            my_object.bang();
+
+            THEN("the repeater repeats the gated sequence each time") {
+                auto& output = *c74::max::object_getoutput(my_object, 0);
+                atoms expected = {1, 1, 0, 3, 3};
+                REQUIRE(output.size() == 2);
+                REQUIRE(output[0] == expected);
+                REQUIRE(output[1] == expected);
+            }
+        }
+
+        WHEN("single steps of the sequence and a pattern are edited between bangs") {
+            atoms stages = {"gates", "repeater"};
+            my_object.stages = stages;
+            my_object.bang();
+            my_object.setstep({2, 7});
+            my_object.setstep({1, 5});
+            my_object.bang();
+            my_object.setpattern({"gates", 1, 1});
+            my_object.bang();
+
+            THEN("each bang sends out the transformed sequence with the edits so far applied") {
+                auto& output = *c74::max::object_getoutput(my_object, 0);
+                atoms after_steps   = {1, 1, 0, 7, 7};
+                atoms after_pattern = {1, 1, 5, 7, 7};
+                REQUIRE(output.size() == 3);
+                REQUIRE(output[1] == after_steps);
+                REQUIRE(output[2] == after_pattern);
+            }
+
+            AND_THEN("the attributes hold the edited steps") {
+                atoms edited_sequence = my_object.sequence.get();
+                atoms edited_gates    = my_object.gates_pattern.get();
+                REQUIRE(edited_sequence == atoms{1, 5, 7});
+                REQUIRE(edited_gates == atoms{1, 1});
+            }
+        }
+    }
+}
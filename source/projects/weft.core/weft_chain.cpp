@@ -0,0 +1,135 @@
+/// @file
+///	@ingroup   weft
+///	@copyright Copyright 2020 Stephen Meyer. All rights reserved.
+///	@licence	     Use of this source code is governed by the MIT License found in the License.md file.
+
+#include "weft_chain.h"
+#include "weft_plan.h"
+
+#include <algorithm>
+#include <utility>
+
+
+namespace weft {
+
+    size_t chain_length(size_t seq_size, std::span<const stage> stages, const chain_patterns& patterns) {
+        size_t length = seq_size;
+
+        for (stage kind : stages)
+            switch (kind) {
+                case stage::rhythm:   length = rhythm_length(length, patterns.rhythm, patterns.length); break;
+                case stage::repeater: length = repeats_length(length, patterns.repeats); break;
+                default:              break;
+            }
+        return length;
+    }
+
+
+    // The number of input steps a rhythm stage reads to write its first `wanted` steps: one per
+    // hit among them, unless that is more than its input holds, when it wraps round the whole input.
+    static size_t rhythm_input_needed(std::span<const int32_t> rhythm, size_t wanted, size_t input_length) {
+        if (rhythm.empty())
+            return 0;
+
+        size_t cycle_hits = std::count_if(rhythm.begin(), rhythm.end(), [](int32_t step) { return step != 0; });
+        size_t hits       = (wanted / rhythm.size()) * cycle_hits;
+        hits += std::count_if(rhythm.begin(), rhythm.begin() + wanted % rhythm.size(), [](int32_t step) { return step != 0; });
+        return std::min(hits, input_length);
+    }
+
+
+    // The number of input steps a repeater stage reads to write its first `wanted` steps: the
+    // shortest start of its input whose repeats add up to at least that many.
+    static size_t repeats_input_needed(std::span<const int32_t> repeats, size_t wanted) {
+        size_t cycle_length = 0;
+        for (int32_t repeat : repeats)
+            cycle_length += std::max(repeat, 0);
+        if (wanted == 0 || cycle_length == 0)
+            return 0;
+
+        size_t cycles    = (wanted - 1) / cycle_length;
+        size_t remaining = wanted - cycles * cycle_length;
+        size_t step      = 0;
+        for (size_t written = 0; ; step++) {
+            written += std::max(repeats[step], 0);
+            if (written >= remaining)
+                break;
+        }
+        return cycles * repeats.size() + step + 1;
+    }
+
+
+    size_t run_chain(std::span<const int32_t> seq, std::span<const stage> stages, const chain_patterns& patterns,
+                     std::vector<int32_t>& out, std::vector<int32_t>& scratch, size_t max_length) {
+        // Every stage writes the start of its output from the start of its input, so a chain cut
+        // short at max_length only runs each stage over the steps the stages after it read. Working
+        // back from the end, `wanted[i]` is the number of steps the output of stage i - 1 (or the
+        // sequence, for i = 0) must hold, and `lengths[i]` is how many it would hold in full. Per
+        // thread, as chains run on the pool's threads during a batch.
+        thread_local std::vector<size_t> lengths;
+        thread_local std::vector<size_t> wanted;
+
+        lengths.resize(stages.size() + 1);
+        wanted.resize(stages.size() + 1);
+
+        lengths[0] = seq.size();
+        for (size_t i = 0; i < stages.size(); i++)
+            lengths[i + 1] = chain_length(lengths[i], stages.subspan(i, 1), patterns);
+
+        wanted[stages.size()] = std::min(lengths[stages.size()], max_length);
+        for (size_t i = stages.size(); i-- > 0; ) {
+            switch (stages[i]) {
+                case stage::rhythm:   wanted[i] = rhythm_input_needed(patterns.rhythm, wanted[i + 1], lengths[i]); break;
+                case stage::repeater: wanted[i] = repeats_input_needed(patterns.repeats, wanted[i + 1]); break;
+                default:              wanted[i] = wanted[i + 1]; break;
+            }
+        }
+
+        // The output of the stages so far: the sequence itself until a stage has written to `out`.
+        // A rhythm stage given only the start of its input never reads far enough to wrap round it.
+        std::span<const int32_t> current = seq.first(wanted[0]);
+        bool                     in_out  = false;
+
+        for (size_t i = 0; i < stages.size(); i++) {
+            bool   whole = wanted[i] == lengths[i] && wanted[i + 1] == lengths[i + 1];
+            size_t kept  = wanted[i + 1];
+
+            switch (stages[i]) {
+                case stage::rhythm:
+                    scratch.resize(kept);
+                    if (auto plan = whole ? rhythm_plan(current.size(), patterns.rhythm, patterns.mode, patterns.length) : nullptr)
+                        gather(current, *plan, scratch);
+                    else
+                        apply_rhythm(current, patterns.rhythm, patterns.mode, scratch);
+                    std::swap(out, scratch);
+                    break;
+                case stage::repeater:
+                    scratch.resize(kept);
+                    if (auto plan = whole ? repeats_plan(current.size(), patterns.repeats) : nullptr)
+                        gather(current, *plan, scratch);
+                    else
+                        apply_repeats(current, patterns.repeats, scratch);
+                    std::swap(out, scratch);
+                    break;
+                case stage::shifter:
+                    if (!in_out)
+                        out.resize(current.size());
+                    apply_shifts(current, patterns.shifts, out);
+                    break;
+                case stage::gates:
+                    if (!in_out)
+                        out.resize(current.size());
+                    apply_gates(current, patterns.gates, out);
+                    break;
+            }
+
+            current = out;
+            in_out  = true;
+        }
+
+        if (!in_out)
+            out.assign(current.begin(), current.end());
+        return out.size();
+    }
+
+}
@@ -0,0 +1,43 @@
+/// @file
+///	@ingroup   weft
+///	@copyright Copyright 2020 Stephen Meyer. All rights reserved.
+///	@licence	     Use of this source code is governed by the MIT License found in the License.md file.
+
+#pragma once
+
+#include "weft_core.h"
+
+
+// Transform pipelines.
+//
+// A chain runs several transforms one after another over typed buffers, as if the objects for each
+// stage were patched in series, without building a list between them.
+namespace weft {
+
+    enum class stage { rhythm, repeater, shifter, gates };
+
+    // The pattern each kind of stage uses, with the rhythm stage's fill mode and length. A kind of
+    // stage that appears more than once in a chain uses the same pattern each time.
+    struct chain_patterns {
+        std::span<const int32_t> rhythm;
+        std::span<const int32_t> repeats;
+        std::span<const int32_t> shifts;
+        std::span<const int32_t> gates;
+        fill_mode                mode   {fill_mode::wrap};
+        int                      length {-1};
+    };
+
+
+    // Length of the sequence after every stage of the chain.
+    size_t chain_length(size_t seq_size, std::span<const stage> stages, const chain_patterns& patterns);
+
+    // Run the stages over the sequence in order, leaving the result in `out`. The shifter and gates
+    // stages work in place; the rhythm and repeater stages gather into `scratch` and swap it with
+    // `out`. Both buffers are resized as needed, so reusing them between calls avoids allocating
+    // once they have grown. A chain cut short at `max_length` runs each stage over only as much of
+    // its input as the rest of the chain reads, so a long output isn't built in full. The result
+    // holds exactly the smaller of chain_length and `max_length` steps; returns that length.
+    size_t run_chain(std::span<const int32_t> seq, std::span<const stage> stages, const chain_patterns& patterns,
+                     std::vector<int32_t>& out, std::vector<int32_t>& scratch, size_t max_length = overflowed_length);
+
+}
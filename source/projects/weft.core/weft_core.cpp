@@ -0,0 +1,638 @@
+/// @file
+///	@ingroup   weft
+///	@copyright Copyright 2020 Stephen Meyer. All rights reserved.
+///	@licence	     Use of this source code is governed by the MIT License found in the License.md file.
+
+#include "weft_core.h"
+
+#include <algorithm>
+#include <utility>
+
+
+namespace weft {
+
+    // Length arithmetic, saturating at overflowed_length.
+    static size_t add_lengths(size_t a, size_t b) {
+        return a > overflowed_length - b ? overflowed_length : a + b;
+    }
+
+
+    static size_t multiply_lengths(size_t a, size_t b) {
+        return b != 0 && a > overflowed_length / b ? overflowed_length : a * b;
+    }
+
+
+    size_t calculate_length(size_t seq_size, std::span<const int32_t> rhythm) {
+        size_t rhythm_hits = std::count_if(rhythm.begin(), rhythm.end(), [](int32_t step) { return step != 0; });
+
+        if (rhythm_hits == 0)
+            return 0;
+        else {
+            size_t step_hits = seq_size / rhythm_hits + (seq_size % rhythm_hits != 0);
+            return multiply_lengths(rhythm.size(), step_hits);
+        }
+    }
+
+
+    size_t calculate_length(std::span<const int32_t> seq, std::span<const int32_t> rhythm) {
+        return calculate_length(seq.size(), rhythm);
+    }
+
+
+    size_t rhythm_length(size_t seq_size, std::span<const int32_t> rhythm, int length) {
+        if (length >= 1)
+            // If a length greater than or equal to 1 has been specified, use it.
+            return length;
+        else
+            // Otherwise calculate the length by applying the rhythmic transformation to all steps in the sequence
+            return calculate_length(seq_size, rhythm);
+    }
+
+
+    size_t rhythm_length(std::span<const int32_t> seq, std::span<const int32_t> rhythm, int length) {
+        return rhythm_length(seq.size(), rhythm, length);
+    }
+
+
+    // The rhythm loop, specialized on the fill mode and step type so that it never tests the mode,
+    // with its counters wrapped by comparison rather than division. Starts at step `rhythm_index`
+    // of the rhythm with `processed` sequence steps already played.
+    template<fill_mode mode, class step_type>
+    static void rhythm_kernel(std::span<const step_type> seq, std::span<const int32_t> rhythm, size_t rhythm_index, size_t processed, std::span<step_type> out) {
+        size_t i = 0;
+
+        if constexpr (mode == fill_mode::silence) {
+            // Play each step of the sequence once, then fall silent.
+            for (size_t seq_index = processed; i < out.size() && seq_index < seq.size(); i++) {
+                out[i] = rhythm[rhythm_index] == 0 ? step_type(0) : seq[seq_index++];
+                if (++rhythm_index == rhythm.size())
+                    rhythm_index = 0;
+            }
+            std::fill(out.begin() + i, out.end(), step_type(0));
+        }
+        else {
+            for (size_t seq_index = processed % seq.size(); i < out.size(); i++) {
+                if (rhythm[rhythm_index] == 0)
+                    out[i] = 0;
+                else {
+                    out[i] = seq[seq_index];
+                    if (++seq_index == seq.size())
+                        seq_index = 0;
+                }
+                if (++rhythm_index == rhythm.size())
+                    rhythm_index = 0;
+            }
+        }
+    }
+
+
+    // Choose the kernel once per call.
+    template<class step_type>
+    static size_t rhythm_from(std::span<const step_type> seq, std::span<const int32_t> rhythm, fill_mode mode, size_t rhythm_index, size_t processed, std::span<step_type> out) {
+        if (rhythm.empty() || seq.empty())
+            std::fill(out.begin(), out.end(), step_type(0));
+        else if (mode == fill_mode::silence)
+            rhythm_kernel<fill_mode::silence>(seq, rhythm, rhythm_index, processed, out);
+        else
+            rhythm_kernel<fill_mode::wrap>(seq, rhythm, rhythm_index, processed, out);
+        return out.size();
+    }
+
+
+    size_t apply_rhythm(std::span<const int32_t> seq, std::span<const int32_t> rhythm, fill_mode mode, std::span<int32_t> out) {
+        return rhythm_from(seq, rhythm, mode, 0, 0, out);
+    }
+
+
+    template<class step_type>
+    size_t apply_rhythm(std::span<const step_type> seq, std::span<const int32_t> rhythm, fill_mode mode, std::span<step_type> out) {
+        return rhythm_from(seq, rhythm, mode, 0, 0, out);
+    }
+
+    template size_t apply_rhythm(std::span<const int8_t>, std::span<const int32_t>, fill_mode, std::span<int8_t>);
+    template size_t apply_rhythm(std::span<const int16_t>, std::span<const int32_t>, fill_mode, std::span<int16_t>);
+    template size_t apply_rhythm(std::span<const int32_t>, std::span<const int32_t>, fill_mode, std::span<int32_t>);
+    template size_t apply_rhythm(std::span<const float>, std::span<const int32_t>, fill_mode, std::span<float>);
+
+
+    size_t apply_rhythm_from(std::span<const int32_t> seq, std::span<const int32_t> rhythm, fill_mode mode, size_t rhythm_index, size_t processed, std::span<int32_t> out) {
+        return rhythm_from(seq, rhythm, mode, rhythm_index, processed, out);
+    }
+
+
+    size_t repeats_length(size_t seq_size, std::span<const int32_t> repeats) {
+        if (repeats.empty())
+            return 0;
+
+        // Whole cycles of the pattern, then the steps of the last, partial cycle.
+        size_t cycle_length   = 0;
+        size_t partial_length = 0;
+        size_t partial_steps  = seq_size % repeats.size();
+
+        for (size_t i = 0; i < repeats.size(); i++) {
+            cycle_length += std::max(repeats[i], 0);
+            if (i < partial_steps)
+                partial_length += std::max(repeats[i], 0);
+        }
+        return add_lengths(multiply_lengths(seq_size / repeats.size(), cycle_length), partial_length);
+    }
+
+
+    size_t repeats_length(std::span<const int32_t> seq, std::span<const int32_t> repeats) {
+        return repeats_length(seq.size(), repeats);
+    }
+
+
+    size_t apply_repeats(std::span<const int32_t> seq, std::span<const int32_t> repeats, std::span<int32_t> out) {
+        if (repeats.empty())
+            return 0;
+
+        size_t written = 0;
+        for (size_t i = 0; i < seq.size() && written < out.size(); i++) {
+            size_t repeat_step = std::max(repeats[i % repeats.size()], 0);
+            size_t count       = std::min(repeat_step, out.size() - written);
+            std::fill_n(out.begin() + written, count, seq[i]);
+            written += count;
+        }
+        return written;
+    }
+
+
+    // Given: 1 2 3
+    // Generate a sequence that is the concatenation of the following segments:
+    // Segment 1: 1 0 2 0 3 0
+    // Segment 2: 1 2 0 3 1 0 2 3 0
+    // Segment 3: 1 2 3 0 1 2 3 0 1 2 3 0
+    //
+    // Each segment applies the rhythm of `segment` hits followed by a rest, wrapping the sequence
+    // to fill seq.size() cycles of that rhythm.
+    size_t melody_iv_length(size_t seq_size) {
+        // sum of seq_size * (segment + 1) for segment in 1..seq_size, halving whichever of
+        // seq_size and seq_size + 1 is even before multiplying
+        size_t triangle = seq_size % 2 == 0 ? multiply_lengths(seq_size / 2, seq_size + 1) : multiply_lengths(seq_size, (seq_size + 1) / 2);
+        return multiply_lengths(seq_size, add_lengths(triangle, seq_size));
+    }
+
+
+    size_t melody_iv(std::span<const int32_t> seq, std::span<int32_t> out) {
+        size_t written = 0;
+
+        for (size_t segment = 1; segment <= seq.size(); segment++) {
+            size_t rhythm_step = 0;
+            size_t seq_index   = 0;
+            size_t length      = seq.size() * (segment + 1);
+
+            for (size_t i = 0; i < length; i++) {
+                if (written == out.size())
+                    return written;
+
+                if (rhythm_step == segment) {
+                    out[written++] = 0;
+                    rhythm_step    = 0;
+                } else {
+                    out[written++] = seq[seq_index];
+                    rhythm_step++;
+                    if (++seq_index == seq.size())
+                        seq_index = 0;
+                }
+            }
+        }
+        return written;
+    }
+
+
+    int32_t melody_iv_at(std::span<const int32_t> seq, size_t index) {
+        // Segment s (from 1) starts at seq.size() * (s - 1) * (s + 2) / 2. Binary search for the
+        // segment holding the index.
+        size_t n     = seq.size();
+        auto   start = [n](size_t segment) { return n * (segment - 1) * (segment + 2) / 2; };
+
+        size_t low = 1, high = n;
+        while (low < high) {
+            size_t mid = (low + high + 1) / 2;
+            if (start(mid) <= index)
+                low = mid;
+            else
+                high = mid - 1;
+        }
+
+        size_t segment     = low;
+        size_t offset      = index - start(segment);
+        size_t rhythm_step = offset % (segment + 1);
+
+        if (rhythm_step == segment)
+            return 0;
+        else
+            return seq[((offset / (segment + 1)) * segment + rhythm_step) % n];
+    }
+
+
+    // Logic: go N / 2 + 1 steps forward, N / 2 steps back through a melody
+    // Given the melody: 1 2 3 4 5 6 7 8 9 10 11 12
+    // Generate a sequence that is the concatenation of the following segments:
+    // Segment 1:   1 2 3 4 5 6 7 7 6 5 4 3 2
+    // Segment 2:   2 3 4 5 6 7 8 8 7 6 5 4 3
+    // ...
+    // Segment 11: 11 12 1 2 3 4 5 5 4 3 2 1 12
+    // Segment 12: 12 1 2 3 4 5 6 6 5 4 3 2 1
+    size_t melody_xi_length(size_t seq_size) {
+        if (seq_size == 0)
+            return 0;
+
+        size_t segment_length = seq_size / 2 + 1;
+        return multiply_lengths(seq_size, 2 * segment_length - 1);
+    }
+
+
+    size_t melody_xi(std::span<const int32_t> seq, std::span<int32_t> out) {
+        size_t segment_length = seq.size() / 2 + 1;
+        size_t written        = 0;
+
+        // Do that dance Paula sang about...
+        for (size_t segment = 0; segment < seq.size(); segment++) {
+
+            // Take two steps forward,
+            for (size_t index = 0; index < segment_length; index++) {
+                if (written == out.size())
+                    return written;
+                out[written++] = seq[(index + segment) % seq.size()];
+            }
+
+            // Take one step back.
+            for (size_t index = segment_length - 1; index > 0; index--) {
+                if (written == out.size())
+                    return written;
+                out[written++] = seq[(index + segment) % seq.size()];
+            }
+        }
+        return written;
+    }
+
+
+    int32_t melody_xi_at(std::span<const int32_t> seq, size_t index) {
+        size_t segment_length = seq.size() / 2 + 1;
+        size_t segment        = index / (2 * segment_length - 1);
+        size_t offset         = index % (2 * segment_length - 1);
+
+        // The second half of each segment mirrors the first, without repeating its first step.
+        if (offset >= segment_length)
+            offset = 2 * segment_length - 1 - offset;
+
+        return seq[(offset + segment) % seq.size()];
+    }
+
+
+    // Given the note series: A G F E D
+    // Generate the self-similar sequence:
+    //
+    // A G G F G E F D
+    // G A E G F F D E
+    // G E A F E D G A
+    // F G F G D A E F
+    // G F E D A G F E
+    // E F D A G G A F
+    // F D G E F A G F
+    // D E A F E F F
+    //
+    // Self-similar by powers of 2. Stepping through the sequence by every note, every 2nd note, every
+    // 4th note, every 8th note will always play the same sequence. Notice in the generated example
+    // above that the first row (every note) and first column (every 8th note) are identical sequences.
+    //
+    // Returns a 63 note sequence by default; the period and base are configurable.
+    //
+    // Step i and step (i * base) % period always hold the same note, so the steps fall into orbits
+    // under multiplication by the base. Taking the orbits in order of their first step, each orbit
+    // is given the next note of the series. Following every orbit once builds the melody in time
+    // linear in the period.
+    size_t melody_xv_length(size_t seq_size, xv_shape shape) {
+        return seq_size == 0 ? 0 : shape.period;
+    }
+
+
+    // Write the rank of each step's orbit into `ranks` (which holds at least `period` steps) and
+    // return the number of orbits. When base and period share a factor an orbit does not come back
+    // round to its first step, so it is followed until it reaches a step that is already ranked.
+    template<class rank_type>
+    static size_t fill_orbit_ranks(xv_shape shape, std::span<rank_type> ranks) {
+        const rank_type unranked = rank_type(-1);
+
+        std::fill_n(ranks.begin(), shape.period, unranked);
+
+        size_t orbits = 0;
+        for (size_t step = 0; step < shape.period; step++) {
+            if (ranks[step] != unranked)
+                continue;
+
+            size_t orbit_step = step;
+            do {
+                ranks[orbit_step] = rank_type(orbits);
+                orbit_step        = (orbit_step * shape.base) % shape.period;
+            } while (ranks[orbit_step] == unranked);
+
+            orbits++;
+        }
+        return orbits;
+    }
+
+
+    size_t xv_orbit_ranks(xv_shape shape, std::span<uint32_t> ranks) {
+        return fill_orbit_ranks(shape, ranks);
+    }
+
+
+    size_t melody_xv(std::span<const int32_t> seq, xv_shape shape, std::span<int32_t> out) {
+        if (seq.empty() || shape.period == 0)
+            return 0;
+
+        size_t length = std::min(shape.period, out.size());
+
+        // Rank the orbits in place when the output holds the whole period.
+        std::vector<int32_t> scratch;
+        std::span<int32_t>   ranks = out;
+        if (out.size() < shape.period) {
+            scratch.resize(shape.period);
+            ranks = scratch;
+        }
+
+        fill_orbit_ranks(shape, ranks);
+
+        for (size_t step = 0; step < length; step++)
+            out[step] = seq[ranks[step] % seq.size()];
+
+        return length;
+    }
+
+
+    int32_t melody_xv_at(std::span<const int32_t> seq, std::span<const uint32_t> orbit_ranks, size_t index) {
+        return seq[orbit_ranks[index] % seq.size()];
+    }
+
+
+    // Given: 1 2 3 4
+    // Generate a sequence of segments, each twice the length of the last (plus one), where every
+    // step of the previous segment is kept and a new step is interleaved between each neighbouring
+    // pair of steps:
+    // Segment 1: 1       2       1
+    // Segment 2: 1   3   2   3   1
+    // Segment 3: 1 2 3 4 2 4 3 2 1
+    //
+    // The segments are built as indices into the sequence directly in the output buffer, each
+    // segment reading from the one before it, and then mapped to sequence values in place.
+    size_t melody_xvi_length(size_t seq_size) {
+        if (seq_size < 2)
+            return seq_size;
+
+        // 3 for the first segment plus 2^i + 1 for each segment i in 2..seq_size-1, which sums to
+        // 2^seq_size + seq_size - 3 and no longer fits in 64 bits from 64 steps on
+        if (seq_size >= 64)
+            return overflowed_length;
+        return (size_t(1) << seq_size) + seq_size - 3;
+    }
+
+
+    size_t melody_xvi(std::span<const int32_t> seq, std::span<int32_t> out) {
+        if (seq.empty() || out.empty())
+            return 0;
+
+        if (seq.size() < 2) {
+            out[0] = seq[0];
+            return 1;
+        }
+
+        const int32_t first_segment[] = {0, 1, 0};
+        size_t written = std::min<size_t>(3, out.size());
+        std::copy_n(first_segment, written, out.begin());
+
+        size_t prev_segment_start = 0;
+
+        for (size_t i = 2; i < seq.size() && written < out.size(); i++) {
+            size_t next_segment_start = written;
+            size_t next_length        = (size_t(1) << i) + 1;
+            size_t prev_segment_idx   = prev_segment_start;
+
+            for (size_t j = 0; j < next_length && written < out.size(); j++) {
+                if (j % 2 == 0) {
+                    out[written++] = out[prev_segment_idx];
+                    prev_segment_idx++;
+                } else {
+                    int32_t neighbors[] = { out[written - 1], out[prev_segment_idx] };
+                    std::sort(neighbors, neighbors + 2);
+
+                    if (neighbors[1] - neighbors[0] == 1)
+                        out[written++] = neighbors[1] + 1;
+                    else
+                        out[written++] = neighbors[1] - 1;
+                }
+            }
+
+            prev_segment_start = next_segment_start;
+        }
+
+        for (size_t i = 0; i < written; i++)
+            out[i] = seq[out[i]];
+
+        return written;
+    }
+
+
+    // The step interleaved between two neighbouring steps of the previous segment.
+    static int32_t xvi_between(int32_t left, int32_t right) {
+        int32_t low  = std::min(left, right);
+        int32_t high = std::max(left, right);
+        return high - low == 1 ? high + 1 : high - 1;
+    }
+
+
+    // Steps `position` and `position + 1` of the given segment. Even steps are carried over from
+    // the previous segment and odd steps are interleaved between two of its neighbours, so each
+    // pair of neighbours depends on a single pair in the segment before.
+    static std::pair<int32_t, int32_t> xvi_pair(size_t segment, size_t position) {
+        static const int32_t first_segment[] = {0, 1, 0};
+
+        if (segment == 1)
+            return { first_segment[position], first_segment[position + 1] };
+
+        if (position % 2 == 0) {
+            auto [left, right] = xvi_pair(segment - 1, position / 2);
+            return { left, xvi_between(left, right) };
+        } else {
+            auto [left, right] = xvi_pair(segment - 1, position / 2);
+            return { xvi_between(left, right), right };
+        }
+    }
+
+
+    int32_t melody_xvi_at(std::span<const int32_t> seq, size_t index) {
+        if (seq.size() < 2)
+            return seq[0];
+
+        // Segment 1 has 3 steps; segment i > 1 has 2^i + 1 steps and starts at 2^i + i - 3.
+        size_t segment = 1;
+        size_t start   = 0;
+        // Past segment 62 the starts no longer fit in 64 bits, so no index reaches them.
+        size_t last_segment = std::min<size_t>(seq.size() - 1, 62);
+        while (segment < last_segment && (size_t(1) << (segment + 1)) + segment - 2 <= index) {
+            segment++;
+            start = (size_t(1) << segment) + segment - 3;
+        }
+
+        size_t position = index - start;
+        size_t length   = segment == 1 ? 3 : (size_t(1) << segment) + 1;
+
+        // The last step has no right-hand neighbour, so read it as the right of the last pair.
+        if (position + 1 == length)
+            return seq[xvi_pair(segment, position - 1).second];
+        else
+            return seq[xvi_pair(segment, position).first];
+    }
+
+
+    rhythm_stepper::rhythm_stepper(std::span<const int32_t> seq, std::span<const int32_t> rhythm, fill_mode mode, int length)
+    : m_seq(seq.begin(), seq.end())
+    , m_rhythm(rhythm.begin(), rhythm.end())
+    , m_mode(mode)
+    , m_length(rhythm_length(seq, rhythm, length))
+    {
+        m_hits_before.reserve(m_rhythm.size());
+        for (int32_t rhythm_step : m_rhythm) {
+            m_hits_before.push_back(m_cycle_hits);
+            if (rhythm_step != 0)
+                m_cycle_hits++;
+        }
+
+        if (m_seq.empty() || m_rhythm.empty())
+            m_cycle_hits = 0;
+    }
+
+
+    int32_t rhythm_stepper::at(size_t index) const {
+        if (m_cycle_hits == 0)
+            return 0;
+
+        size_t cycle       = index / m_rhythm.size();
+        size_t rhythm_step = index % m_rhythm.size();
+
+        if (m_rhythm[rhythm_step] == 0)
+            return 0;
+
+        // The number of sequence steps already played is the hits in every whole rhythm cycle
+        // before this one plus the hits earlier in this cycle.
+        size_t processed_step_index = cycle * m_cycle_hits + m_hits_before[rhythm_step];
+
+        if (processed_step_index >= m_seq.size() && m_mode == fill_mode::silence)
+            return 0;
+        else
+            return m_seq[processed_step_index % m_seq.size()];
+    }
+
+
+    repeats_stepper::repeats_stepper(std::span<const int32_t> seq, std::span<const int32_t> repeats)
+    : m_seq(seq.begin(), seq.end())
+    , m_length(repeats_length(seq, repeats))
+    {
+        size_t total = 0;
+        m_repeats_end.reserve(repeats.size());
+        for (int32_t repeat_step : repeats) {
+            total += std::max(repeat_step, 0);
+            m_repeats_end.push_back(total);
+        }
+    }
+
+
+    int32_t repeats_stepper::at(size_t index) const {
+        if (m_length == 0)
+            return 0;
+
+        // Find the cycle of the repeats pattern, then binary search the steps within it.
+        size_t cycle_length = m_repeats_end.back();
+        size_t cycle        = index / cycle_length;
+        size_t offset       = index % cycle_length;
+        size_t repeat_step  = std::upper_bound(m_repeats_end.begin(), m_repeats_end.end(), offset) - m_repeats_end.begin();
+
+        return m_seq[cycle * m_repeats_end.size() + repeat_step];
+    }
+
+
+    shifts_stepper::shifts_stepper(std::span<const int32_t> seq, std::span<const int32_t> shifts)
+    : m_seq(seq.begin(), seq.end())
+    , m_shifts(shifts.begin(), shifts.end())
+    {}
+
+
+    int32_t shift_step(int32_t step, int32_t shift) {
+        return step == 0 ? 0 : int32_t(uint32_t(step) + uint32_t(shift));
+    }
+
+
+    int32_t gate_step(int32_t step, int32_t gate) {
+        return gate == 0 ? 0 : step;
+    }
+
+
+    int32_t shifts_stepper::at(size_t index) const {
+        if (m_shifts.empty())
+            return m_seq[index];
+        else
+            return shift_step(m_seq[index], m_shifts[index % m_shifts.size()]);
+    }
+
+
+    gates_stepper::gates_stepper(std::span<const int32_t> seq, std::span<const int32_t> gates)
+    : m_seq(seq.begin(), seq.end())
+    , m_gates(gates.begin(), gates.end())
+    {}
+
+
+    int32_t gates_stepper::at(size_t index) const {
+        if (m_gates.empty())
+            return m_seq[index];
+        else
+            return gate_step(m_seq[index], m_gates[index % m_gates.size()]);
+    }
+
+
+    size_t melody_length(melody which, size_t seq_size, xv_shape shape) {
+        switch (which) {
+            case melody::iv:  return melody_iv_length(seq_size);
+            case melody::xi:  return melody_xi_length(seq_size);
+            case melody::xv:  return melody_xv_length(seq_size, shape);
+            case melody::xvi: return melody_xvi_length(seq_size);
+        }
+        return 0;
+    }
+
+
+    size_t apply_melody(melody which, std::span<const int32_t> seq, xv_shape shape, std::span<int32_t> out) {
+        switch (which) {
+            case melody::iv:  return melody_iv(seq, out);
+            case melody::xi:  return melody_xi(seq, out);
+            case melody::xv:  return melody_xv(seq, shape, out);
+            case melody::xvi: return melody_xvi(seq, out);
+        }
+        return 0;
+    }
+
+
+    melody_stepper::melody_stepper(std::span<const int32_t> seq, melody which, xv_shape shape)
+    : m_seq(seq.begin(), seq.end())
+    , m_melody(which)
+    , m_length(melody_length(which, seq.size(), shape))
+    {
+        if (m_melody == melody::xv && m_length > 0) {
+            m_xv_orbit_ranks.resize(shape.period);
+            xv_orbit_ranks(shape, m_xv_orbit_ranks);
+        }
+    }
+
+
+    int32_t melody_stepper::at(size_t index) const {
+        switch (m_melody) {
+            case melody::iv:  return melody_iv_at(m_seq, index);
+            case melody::xi:  return melody_xi_at(m_seq, index);
+            case melody::xv:  return melody_xv_at(m_seq, m_xv_orbit_ranks, index);
+            case melody::xvi: return melody_xvi_at(m_seq, index);
+        }
+        return 0;
+    }
+
+}
@@ -0,0 +1,194 @@
+/// @file
+///	@ingroup   weft
+///	@copyright Copyright 2020 Stephen Meyer. All rights reserved.
+///	@licence	     Use of this source code is governed by the MIT License found in the License.md file.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+
+// The weft transforms, free of any Max types.
+//
+// Every transform reads typed sequences and patterns and writes into an output buffer owned by the
+// caller. The matching *_length function returns the number of steps a transform produces so the
+// caller can size that buffer up front. A transform writes at most out.size() steps and returns the
+// number of steps it wrote, so a short buffer truncates the output rather than overrunning it.
+//
+// The lengths are exact. A length too large to hold in a size_t, such as that of melody XVI on 64
+// steps or more, saturates at overflowed_length rather than wrapping round to a small number.
+namespace weft {
+
+    constexpr size_t overflowed_length = SIZE_MAX;
+
+    enum class fill_mode { wrap, silence };
+
+
+    // Length of a sequence after applying a rhythm: the smallest whole number of rhythm cycles
+    // with enough hits (non-zero steps) to play every step of the sequence once.
+    size_t calculate_length(size_t seq_size, std::span<const int32_t> rhythm);
+    size_t calculate_length(std::span<const int32_t> seq, std::span<const int32_t> rhythm);
+
+    // Length of the rhythm transform, honouring an explicit length of 1 or more.
+    size_t rhythm_length(size_t seq_size, std::span<const int32_t> rhythm, int length);
+    size_t rhythm_length(std::span<const int32_t> seq, std::span<const int32_t> rhythm, int length);
+
+    // Play the sequence on the hits of the rhythm and rest (0) on the remaining steps. Writes
+    // out.size() steps; once the sequence is exhausted it either wraps or falls silent.
+    size_t apply_rhythm(std::span<const int32_t> seq, std::span<const int32_t> rhythm, fill_mode mode, std::span<int32_t> out);
+
+    // apply_rhythm for sequences of other step types. Instantiated for int8_t, int16_t, int32_t and
+    // float.
+    template<class step_type>
+    size_t apply_rhythm(std::span<const step_type> seq, std::span<const int32_t> rhythm, fill_mode mode, std::span<step_type> out);
+
+    // apply_rhythm starting part of the way through, at step `rhythm_index` of the rhythm with
+    // `processed` sequence steps already played, so that threads can each fill a range of the output.
+    size_t apply_rhythm_from(std::span<const int32_t> seq, std::span<const int32_t> rhythm, fill_mode mode, size_t rhythm_index, size_t processed, std::span<int32_t> out);
+
+
+    // Length of the repeater transform: the sum of the repeat counts applied to each step.
+    size_t repeats_length(size_t seq_size, std::span<const int32_t> repeats);
+    size_t repeats_length(std::span<const int32_t> seq, std::span<const int32_t> repeats);
+
+    // Repeat each step of the sequence by the corresponding count in the (cycled) repeats pattern.
+    size_t apply_repeats(std::span<const int32_t> seq, std::span<const int32_t> repeats, std::span<int32_t> out);
+
+
+    // Add the (cycled) shift pattern to every non-zero step of the sequence. Rests stay at 0.
+    // This and apply_gates are vectorized; see weft_simd.h.
+    size_t apply_shifts(std::span<const int32_t> seq, std::span<const int32_t> shifts, std::span<int32_t> out);
+
+    // Silence every step of the sequence whose (cycled) gate is 0.
+    size_t apply_gates(std::span<const int32_t> seq, std::span<const int32_t> gates, std::span<int32_t> out);
+
+    // One output step of apply_shifts and apply_gates, from the sequence step and the pattern step
+    // lined up with it.
+    int32_t shift_step(int32_t step, int32_t shift);
+    int32_t gate_step(int32_t step, int32_t gate);
+
+    // Append to `changed` the index of every step of `next` that differs from the same step of
+    // `previous`, in order. Steps past the end of `previous` all count as changed. Vectorized like
+    // apply_shifts.
+    void changed_steps(std::span<const int32_t> previous, std::span<const int32_t> next, std::vector<size_t>& changed);
+
+
+    // Rational melodies. See the implementations for a description of each algorithm. Each melody
+    // also has an *_at function that computes a single step from its index (which must be less
+    // than the melody's length) without generating the rest of the melody.
+    enum class melody { iv, xi, xv, xvi };
+
+    // Melody XV is self-similar by powers of `base` over `period` steps. It is strictly self-similar
+    // when base and period share no factor, as with the original 63 steps by powers of 2.
+    struct xv_shape {
+        size_t period {63};
+        size_t base   {2};
+    };
+
+    size_t melody_iv_length(size_t seq_size);
+    size_t melody_iv(std::span<const int32_t> seq, std::span<int32_t> out);
+    int32_t melody_iv_at(std::span<const int32_t> seq, size_t index);
+
+    size_t melody_xi_length(size_t seq_size);
+    size_t melody_xi(std::span<const int32_t> seq, std::span<int32_t> out);
+    int32_t melody_xi_at(std::span<const int32_t> seq, size_t index);
+
+    size_t melody_xv_length(size_t seq_size, xv_shape shape = {});
+    size_t melody_xv(std::span<const int32_t> seq, xv_shape shape, std::span<int32_t> out);
+    size_t xv_orbit_ranks(xv_shape shape, std::span<uint32_t> ranks);
+    int32_t melody_xv_at(std::span<const int32_t> seq, std::span<const uint32_t> orbit_ranks, size_t index);
+
+    size_t melody_xvi_length(size_t seq_size);
+    size_t melody_xvi(std::span<const int32_t> seq, std::span<int32_t> out);
+    int32_t melody_xvi_at(std::span<const int32_t> seq, size_t index);
+
+    size_t melody_length(melody which, size_t seq_size, xv_shape shape = {});
+    size_t apply_melody(melody which, std::span<const int32_t> seq, xv_shape shape, std::span<int32_t> out);
+
+
+    // Step-by-step playback.
+    //
+    // A stepper is built once from a transform's inputs and then computes any single output step
+    // directly from its index, without producing the rest of the output. at() requires
+    // index < length().
+
+    class rhythm_stepper {
+    public:
+        rhythm_stepper() = default;
+        rhythm_stepper(std::span<const int32_t> seq, std::span<const int32_t> rhythm, fill_mode mode, int length);
+
+        size_t  length() const { return m_length; }
+        int32_t at(size_t index) const;
+
+    private:
+        std::vector<int32_t> m_seq;
+        std::vector<int32_t> m_rhythm;
+        std::vector<size_t>  m_hits_before;     // the number of hits in the rhythm before each step
+        size_t               m_cycle_hits {0};
+        fill_mode            m_mode {fill_mode::wrap};
+        size_t               m_length {0};
+    };
+
+
+    class repeats_stepper {
+    public:
+        repeats_stepper() = default;
+        repeats_stepper(std::span<const int32_t> seq, std::span<const int32_t> repeats);
+
+        size_t  length() const { return m_length; }
+        int32_t at(size_t index) const;
+
+    private:
+        std::vector<int32_t> m_seq;
+        std::vector<size_t>  m_repeats_end;     // output steps produced by one cycle of the pattern up to and including each step
+        size_t               m_length {0};
+    };
+
+
+    class shifts_stepper {
+    public:
+        shifts_stepper() = default;
+        shifts_stepper(std::span<const int32_t> seq, std::span<const int32_t> shifts);
+
+        size_t  length() const { return m_seq.size(); }
+        int32_t at(size_t index) const;
+
+    private:
+        std::vector<int32_t> m_seq;
+        std::vector<int32_t> m_shifts;
+    };
+
+
+    class gates_stepper {
+    public:
+        gates_stepper() = default;
+        gates_stepper(std::span<const int32_t> seq, std::span<const int32_t> gates);
+
+        size_t  length() const { return m_seq.size(); }
+        int32_t at(size_t index) const;
+
+    private:
+        std::vector<int32_t> m_seq;
+        std::vector<int32_t> m_gates;
+    };
+
+
+    class melody_stepper {
+    public:
+        melody_stepper() = default;
+        melody_stepper(std::span<const int32_t> seq, melody which, xv_shape shape = {});
+
+        size_t  length() const { return m_length; }
+        int32_t at(size_t index) const;
+
+    private:
+        std::vector<int32_t>  m_seq;
+        std::vector<uint32_t> m_xv_orbit_ranks;
+        melody                m_melody {melody::xi};
+        size_t                m_length {0};
+    };
+
+}
@@ -0,0 +1,259 @@
+/// @file
+///	@ingroup   weft
+///	@copyright Copyright 2020 Stephen Meyer. All rights reserved.
+///	@licence	     Use of this source code is governed by the MIT License found in the License.md file.
+
+#include "weft_file.h"
+
+#include <bit>
+#include <cstdio>
+#include <cstring>
+
+#ifdef _WIN32
+    #define NOMINMAX
+    #define WIN32_LEAN_AND_MEAN
+    #include <windows.h>
+#else
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+
+// Steps are mapped and written as they lie in memory, which matches the format on every platform
+// Max runs on.
+static_assert(std::endian::native == std::endian::little, ".weft files are little-endian");
+
+
+namespace weft {
+
+    namespace {
+
+        constexpr char     file_magic[4] = {'W', 'E', 'F', 'T'};
+        constexpr uint16_t file_version  = 1;
+        constexpr uint16_t int32_type    = 1;
+
+
+        struct file_header {
+            char     magic[4];
+            uint16_t version;
+            uint16_t type;
+            uint32_t lanes;
+            uint32_t reserved;
+            uint64_t length;
+            uint64_t checksum;
+        };
+
+        static_assert(sizeof(file_header) == 32, "the header must match the format");
+
+
+        // Map a whole file read only. Returns nullptr if it can't be opened or is empty.
+        const void* map_file(const std::string& path, size_t& size) {
+#ifdef _WIN32
+            HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+            if (file == INVALID_HANDLE_VALUE)
+                return nullptr;
+
+            LARGE_INTEGER file_size;
+            const void*   mapping = nullptr;
+            if (GetFileSizeEx(file, &file_size) && file_size.QuadPart > 0) {
+                // The view keeps the mapping open once both handles are closed.
+                HANDLE map = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+                if (map) {
+                    mapping = MapViewOfFile(map, FILE_MAP_READ, 0, 0, 0);
+                    size    = size_t(file_size.QuadPart);
+                    CloseHandle(map);
+                }
+            }
+            CloseHandle(file);
+            return mapping;
+#else
+            int file = ::open(path.c_str(), O_RDONLY);
+            if (file < 0)
+                return nullptr;
+
+            struct stat info;
+            void*       mapping = nullptr;
+            if (fstat(file, &info) == 0 && info.st_size > 0) {
+                mapping = mmap(nullptr, size_t(info.st_size), PROT_READ, MAP_PRIVATE, file, 0);
+                size    = size_t(info.st_size);
+                if (mapping == MAP_FAILED)
+                    mapping = nullptr;
+            }
+            ::close(file);
+            return mapping;
+#endif
+        }
+
+
+        void unmap_file(const void* mapping, size_t size) {
+#ifdef _WIN32
+            (void)size;
+            UnmapViewOfFile(mapping);
+#else
+            munmap(const_cast<void*>(mapping), size);
+#endif
+        }
+
+
+        // Move the file at `from` to `to`, replacing any file there. Returns false if it can't.
+        bool replace_file(const std::string& from, const std::string& to) {
+#ifdef _WIN32
+            return MoveFileExA(from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+            return std::rename(from.c_str(), to.c_str()) == 0;
+#endif
+        }
+
+    }
+
+
+    const char* describe(file_status status) {
+        switch (status) {
+            case file_status::ok:           return "ok";
+            case file_status::unreadable:   return "the file couldn't be opened";
+            case file_status::not_weft:     return "it isn't a .weft file";
+            case file_status::unsupported:  return "its version or step type isn't supported";
+            case file_status::truncated:    return "it is shorter or longer than its header says";
+            case file_status::bad_checksum: return "its checksum doesn't match its steps";
+            case file_status::unwritable:   return "the file couldn't be written";
+            case file_status::uneven_lanes: return "its lanes aren't all the same length";
+            case file_status::too_long:     return "a lane is too long to compute";
+        }
+        return "unknown error";
+    }
+
+
+    // FNV-1a over each step, with every fourth step hashed in turn by one of four hashes so that
+    // they run in parallel.
+    void step_checksum::add(std::span<const int32_t> steps) {
+        for (int32_t step : steps) {
+            uint64_t& hash = m_hash[m_count++ % 4];
+            hash = (hash ^ uint32_t(step)) * 1099511628211ull;
+        }
+    }
+
+
+    uint64_t step_checksum::value() const {
+        uint64_t hash = 14695981039346656037ull;
+        for (uint64_t each : m_hash)
+            hash = (hash ^ each) * 1099511628211ull;
+        return (hash ^ m_count) * 1099511628211ull;
+    }
+
+
+    std::shared_ptr<const sequence_file> sequence_file::open(const std::string& path, file_status& status) {
+        size_t      size    = 0;
+        const void* mapping = map_file(path, size);
+        if (!mapping) {
+            status = file_status::unreadable;
+            return nullptr;
+        }
+
+        std::shared_ptr<sequence_file> file { new sequence_file };
+        file->m_mapping = mapping;
+        file->m_size    = size;
+
+        file_header header;
+        if (size < sizeof(header)) {
+            status = file_status::not_weft;
+            return nullptr;
+        }
+        std::memcpy(&header, mapping, sizeof(header));
+
+        if (std::memcmp(header.magic, file_magic, sizeof(file_magic)) != 0) {
+            status = file_status::not_weft;
+            return nullptr;
+        }
+        if (header.version != file_version || header.type != int32_type) {
+            status = file_status::unsupported;
+            return nullptr;
+        }
+
+        // Checked by division, so that a corrupt header can't overflow the expected size.
+        size_t data_size = size - sizeof(header);
+        if (header.lanes != 0 && header.length > data_size / sizeof(int32_t) / header.lanes) {
+            status = file_status::truncated;
+            return nullptr;
+        }
+        if (data_size != size_t(header.lanes) * size_t(header.length) * sizeof(int32_t)) {
+            status = file_status::truncated;
+            return nullptr;
+        }
+
+        // The data starts 32 bytes into a page-aligned mapping, so it is aligned for int32.
+        file->m_steps  = reinterpret_cast<const int32_t*>(static_cast<const char*>(mapping) + sizeof(header));
+        file->m_lanes  = header.lanes;
+        file->m_length = size_t(header.length);
+
+        step_checksum checksum;
+        checksum.add({ file->m_steps, file->m_lanes * file->m_length });
+        if (checksum.value() != header.checksum) {
+            status = file_status::bad_checksum;
+            return nullptr;
+        }
+
+        status = file_status::ok;
+        return file;
+    }
+
+
+    sequence_file::~sequence_file() {
+        if (m_mapping)
+            unmap_file(m_mapping, m_size);
+    }
+
+
+    sequence_writer::sequence_writer(const std::string& path)
+    : m_path      { path }
+    , m_temp_path { path + ".tmp" }
+    , m_file      { m_temp_path, std::ios::binary | std::ios::trunc }
+    {
+        // Room for the header, which finish fills in.
+        file_header placeholder {};
+        m_file.write(reinterpret_cast<const char*>(&placeholder), sizeof(placeholder));
+    }
+
+
+    sequence_writer::~sequence_writer() {
+        if (!m_finished) {
+            m_file.close();
+            std::remove(m_temp_path.c_str());
+        }
+    }
+
+
+    file_status sequence_writer::write_lane(std::span<const int32_t> steps) {
+        if (m_lanes == 0)
+            m_length = steps.size();
+        else if (steps.size() != m_length)
+            return file_status::uneven_lanes;
+
+        m_file.write(reinterpret_cast<const char*>(steps.data()), std::streamsize(steps.size_bytes()));
+        m_checksum.add(steps);
+        m_lanes++;
+        return m_file ? file_status::ok : file_status::unwritable;
+    }
+
+
+    file_status sequence_writer::finish() {
+        file_header header {};
+        std::memcpy(header.magic, file_magic, sizeof(file_magic));
+        header.version  = file_version;
+        header.type     = int32_type;
+        header.lanes    = uint32_t(m_lanes);
+        header.length   = m_length;
+        header.checksum = m_checksum.value();
+
+        m_file.seekp(0);
+        m_file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        m_file.close();
+        if (!m_file || !replace_file(m_temp_path, m_path))
+            return file_status::unwritable;
+
+        m_finished = true;
+        return file_status::ok;
+    }
+
+}
@@ -0,0 +1,110 @@
+/// @file
+///	@ingroup   weft
+///	@copyright Copyright 2020 Stephen Meyer. All rights reserved.
+///	@licence	     Use of this source code is governed by the MIT License found in the License.md file.
+
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <span>
+#include <string>
+
+
+// .weft files.
+//
+// A .weft file holds any number of lanes, each a sequence of the same length, as raw steps. It
+// starts with a 32-byte header, every field little-endian:
+//
+//     0   "WEFT"
+//     4   uint16  format version, 1
+//     6   uint16  element type, 1 for int32
+//     8   uint32  number of lanes
+//     12  uint32  reserved, 0
+//     16  uint64  steps in each lane
+//     24  uint64  checksum of the data
+//
+// The data follows, one lane after another, each step a little-endian int32. Files are read by
+// mapping them into memory, so a lane is handed to the transforms where it lies, without copying.
+namespace weft {
+
+    enum class file_status { ok, unreadable, not_weft, unsupported, truncated, bad_checksum, unwritable, uneven_lanes, too_long };
+
+    // A short description of a status, for error messages.
+    const char* describe(file_status status);
+
+
+    // A running checksum of steps, which needn't all be added at once.
+    class step_checksum {
+    public:
+        void     add(std::span<const int32_t> steps);
+        uint64_t value() const;
+
+    private:
+        uint64_t m_hash[4] {14695981039346656037ull, 14695981039346656037ull, 14695981039346656037ull, 14695981039346656037ull};
+        uint64_t m_count   {0};
+    };
+
+
+    // A .weft file mapped into memory, read only. The lanes stay valid as long as it does.
+    class sequence_file {
+    public:
+        // Map and check the file at `path`. Returns nullptr, with `status` saying why, if it can't
+        // be read or isn't a whole .weft file of int32 steps with the right checksum.
+        static std::shared_ptr<const sequence_file> open(const std::string& path, file_status& status);
+
+        ~sequence_file();
+
+        sequence_file(const sequence_file&)            = delete;
+        sequence_file& operator=(const sequence_file&) = delete;
+
+        size_t lanes() const  { return m_lanes; }
+        size_t length() const { return m_length; }
+
+        std::span<const int32_t> lane(size_t index) const {
+            return { m_steps + index * m_length, m_length };
+        }
+
+    private:
+        sequence_file() = default;
+
+        const void*    m_mapping {nullptr};
+        size_t         m_size    {0};
+        const int32_t* m_steps   {nullptr};
+        size_t         m_lanes   {0};
+        size_t         m_length  {0};
+    };
+
+
+    // Writes a .weft file a lane at a time, so that no more than one lane need be held in memory.
+    // The header is written last, once the lanes and checksum are known.
+    //
+    // The lanes go to a temporary file beside `path`, which finish renames over it. Until then any
+    // file already at `path` is left as it was, and a writer that fails or is never finished
+    // removes its temporary file.
+    class sequence_writer {
+    public:
+        explicit sequence_writer(const std::string& path);
+        ~sequence_writer();
+
+        sequence_writer(const sequence_writer&)            = delete;
+        sequence_writer& operator=(const sequence_writer&) = delete;
+
+        // Append a lane. Every lane must be as long as the first.
+        file_status write_lane(std::span<const int32_t> steps);
+
+        // Write the header, close the file and move it to `path`.
+        file_status finish();
+
+    private:
+        std::string   m_path;
+        std::string   m_temp_path;
+        bool          m_finished {false};
+        std::ofstream m_file;
+        step_checksum m_checksum;
+        size_t        m_lanes  {0};
+        size_t        m_length {0};
+    };
+
+}
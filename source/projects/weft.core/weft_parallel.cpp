@@ -0,0 +1,354 @@
+/// @file
+///	@ingroup   weft
+///	@copyright Copyright 2020 Stephen Meyer. All rights reserved.
+///	@licence	     Use of this source code is governed by the MIT License found in the License.md file.
+
+#include "weft_parallel.h"
+#include "weft_plan.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+
+namespace weft {
+
+    namespace {
+
+        // One call's share of the work, queued once for every extra thread it wants. Whichever
+        // threads pick up its entries all run the same function, which hands out ranges itself.
+        struct job {
+            void (*run)(void* context);
+            void*                   context;
+            std::atomic<unsigned>   unfinished;
+            std::mutex              mutex;
+            std::condition_variable finished;
+        };
+
+    }
+
+
+    class thread_pool {
+    public:
+        explicit thread_pool(unsigned worker_count)
+        : m_queues(worker_count)
+        , m_worker_count(worker_count)
+        {
+            for (unsigned index = 0; index < worker_count; index++)
+                m_queues[index] = std::make_unique<queue>();
+            for (unsigned index = 0; index < worker_count; index++)
+                m_workers.emplace_back([this, index] { work(index); });
+        }
+
+
+        ~thread_pool() {
+            {
+                std::lock_guard<std::mutex> lock {m_idle_mutex};
+                m_stopping = true;
+            }
+            m_idle.notify_all();
+            for (std::thread& worker : m_workers)
+                worker.join();
+        }
+
+
+        unsigned worker_count() const {
+            return m_worker_count;
+        }
+
+
+        // Run `task` on the calling thread and on up to `extra` pool threads, returning once
+        // all of them have finished it.
+        void run(unsigned extra, void (*task)(void*), void* context) {
+            job shared_job { task, context, { extra }, {}, {} };
+
+            // Spread the entries over the workers' queues, starting at a different queue each
+            // time so that concurrent callers don't all land on the first worker.
+            unsigned first = m_next_queue.fetch_add(1) % worker_count();
+            for (unsigned entry = 0; entry < extra; entry++) {
+                queue& target = *m_queues[(first + entry) % worker_count()];
+                std::lock_guard<std::mutex> lock {target.mutex};
+                target.jobs.push_back(&shared_job);
+            }
+            {
+                std::lock_guard<std::mutex> lock {m_idle_mutex};
+                m_queued += extra;
+            }
+            m_idle.notify_all();
+
+            task(context);
+
+            // Run our own entries that no worker has reached yet, then wait for the rest. Other
+            // callers' entries are left to the workers, so that a bang never ends up running
+            // some other object's work.
+            while (shared_job.unfinished.load() > 0) {
+                if (take(shared_job, first))
+                    execute(shared_job);
+                else {
+                    std::unique_lock<std::mutex> lock {shared_job.mutex};
+                    shared_job.finished.wait(lock, [&] { return shared_job.unfinished.load() == 0; });
+                }
+            }
+
+            // The last thread to finish may still hold the job's mutex; wait for it to let go
+            // before the job goes out of scope.
+            std::lock_guard<std::mutex> lock {shared_job.mutex};
+        }
+
+    private:
+        struct queue {
+            std::mutex        mutex;
+            std::deque<job*>  jobs;
+        };
+
+
+        // Take an entry, from the back of our own queue first and then from the front of the
+        // others', oldest first.
+        job* steal(unsigned own) {
+            for (unsigned offset = 0; offset < worker_count(); offset++) {
+                queue& source = *m_queues[(own + offset) % worker_count()];
+                std::lock_guard<std::mutex> lock {source.mutex};
+
+                if (!source.jobs.empty()) {
+                    job* taken;
+                    if (offset == 0) {
+                        taken = source.jobs.back();
+                        source.jobs.pop_back();
+                    } else {
+                        taken = source.jobs.front();
+                        source.jobs.pop_front();
+                    }
+
+                    std::lock_guard<std::mutex> idle_lock {m_idle_mutex};
+                    m_queued--;
+                    return taken;
+                }
+            }
+            return nullptr;
+        }
+
+
+        // Remove one of `target`'s entries from the queues, if any is left.
+        bool take(job& target, unsigned first) {
+            for (unsigned offset = 0; offset < worker_count(); offset++) {
+                queue& source = *m_queues[(first + offset) % worker_count()];
+                std::lock_guard<std::mutex> lock {source.mutex};
+
+                auto found = std::find(source.jobs.rbegin(), source.jobs.rend(), &target);
+                if (found != source.jobs.rend()) {
+                    source.jobs.erase(std::next(found).base());
+
+                    std::lock_guard<std::mutex> idle_lock {m_idle_mutex};
+                    m_queued--;
+                    return true;
+                }
+            }
+            return false;
+        }
+
+
+        void execute(job& taken) {
+            taken.run(taken.context);
+
+            // Notify under the job's mutex so that its owner can't return, and destroy it,
+            // between the count reaching zero and the notification.
+            std::lock_guard<std::mutex> lock {taken.mutex};
+            if (taken.unfinished.fetch_sub(1) == 1)
+                taken.finished.notify_all();
+        }
+
+
+        void work(unsigned index) {
+            while (true) {
+                if (job* taken = steal(index)) {
+                    execute(*taken);
+                    continue;
+                }
+
+                std::unique_lock<std::mutex> lock {m_idle_mutex};
+                m_idle.wait(lock, [this] { return m_stopping || m_queued > 0; });
+                if (m_stopping)
+                    return;
+            }
+        }
+
+
+        std::vector<std::unique_ptr<queue>> m_queues;
+        std::vector<std::thread>            m_workers;
+        const unsigned                      m_worker_count;
+        std::atomic<unsigned>               m_next_queue {0};
+
+        std::mutex                          m_idle_mutex;
+        std::condition_variable             m_idle;
+        size_t                              m_queued   {0};
+        bool                                m_stopping {false};
+    };
+
+
+    namespace {
+
+        std::atomic<thread_pool*> shared_pool {nullptr};
+
+
+        // The pool handed to share_thread_pool, or else this copy's own.
+        thread_pool& pool() {
+            if (thread_pool* shared = shared_pool.load(std::memory_order_acquire))
+                return *shared;
+
+            static thread_pool own { std::max(hardware_threads(), 2u) - 1 };
+            return own;
+        }
+
+
+        // Rhythm steps [begin, end) of the output, picking up the sequence where the steps before
+        // `begin` left it.
+        void rhythm_range(std::span<const int32_t> seq, std::span<const int32_t> rhythm, std::span<const size_t> hits_before,
+                          fill_mode mode, std::span<int32_t> out, size_t begin, size_t end) {
+            size_t rhythm_index = begin % rhythm.size();
+            size_t processed    = (begin / rhythm.size()) * hits_before[rhythm.size()] + hits_before[rhythm_index];
+
+            apply_rhythm_from(seq, rhythm, mode, rhythm_index, processed, out.subspan(begin, end - begin));
+        }
+
+
+        // Split `count` items into ranges small enough for every thread to get several.
+        size_t grain_for(size_t count, unsigned threads, size_t minimum) {
+            return std::max(minimum, count / (size_t(threads) * 8) + 1);
+        }
+
+    }
+
+
+    unsigned hardware_threads() {
+        return std::max(std::thread::hardware_concurrency(), 1u);
+    }
+
+
+    thread_pool* make_thread_pool() {
+        return new thread_pool { std::max(hardware_threads(), 2u) - 1 };
+    }
+
+
+    void share_thread_pool(thread_pool& pool) {
+        shared_pool.store(&pool, std::memory_order_release);
+    }
+
+
+    void parallel_for(size_t count, size_t grain, unsigned threads, range_function body, void* context) {
+        grain = std::max<size_t>(grain, 1);
+        size_t chunks = (count + grain - 1) / grain;
+
+        if (threads <= 1 || chunks <= 1) {
+            body(context, 0, count);
+            return;
+        }
+
+        struct shared_work {
+            size_t              count;
+            size_t              grain;
+            size_t              chunks;
+            range_function      body;
+            void*               context;
+            std::atomic<size_t> next_chunk {0};
+        } work { count, grain, chunks, body, context };
+
+        auto take_chunks = [](void* shared) {
+            auto& work = *static_cast<shared_work*>(shared);
+            for (size_t chunk; (chunk = work.next_chunk.fetch_add(1)) < work.chunks; )
+                work.body(work.context, chunk * work.grain, std::min(work.count, (chunk + 1) * work.grain));
+        };
+
+        thread_pool& workers = pool();
+        unsigned     extra   = unsigned(std::min<size_t>({ size_t(threads) - 1, chunks - 1, workers.worker_count() }));
+        workers.run(extra, take_chunks, &work);
+    }
+
+
+    size_t parallel_apply_rhythm(std::span<const int32_t> seq, std::span<const int32_t> rhythm, fill_mode mode, std::span<int32_t> out, unsigned threads) {
+        if (threads <= 1 || out.size() < parallel_threshold || rhythm.empty() || seq.empty())
+            return apply_rhythm(seq, rhythm, mode, out);
+
+        // hits_before[i] is the number of hits in the rhythm before step i; the last entry is the
+        // number of hits in a whole cycle.
+        std::vector<size_t> hits_before(rhythm.size() + 1, 0);
+        for (size_t i = 0; i < rhythm.size(); i++)
+            hits_before[i + 1] = hits_before[i] + (rhythm[i] != 0);
+
+        parallel_for(out.size(), grain_for(out.size(), threads, 16384), threads, [&](size_t begin, size_t end) {
+            rhythm_range(seq, rhythm, hits_before, mode, out, begin, end);
+        });
+        return out.size();
+    }
+
+
+    size_t parallel_apply_melody(melody which, std::span<const int32_t> seq, xv_shape shape, std::span<int32_t> out, unsigned threads) {
+        size_t n = seq.size();
+        if (threads <= 1 || out.size() < parallel_threshold || (which != melody::iv && which != melody::xi))
+            return apply_melody(which, seq, shape, out);
+
+        size_t written = std::min(out.size(), melody_length(which, n, shape));
+
+        if (which == melody::iv) {
+            // Segment s (from 1) plays the sequence on a rhythm of s hits and a rest, n * (s + 1)
+            // steps long, starting after the segments before it.
+            parallel_for(n, grain_for(n, threads, 1), threads, [&](size_t first, size_t last) {
+                for (size_t segment = first + 1; segment <= last; segment++) {
+                    size_t start = n * (segment - 1) * (segment + 2) / 2;
+                    size_t end   = std::min(start + n * (segment + 1), written);
+
+                    size_t rhythm_step = 0;
+                    size_t seq_index   = 0;
+                    for (size_t i = start; i < end; i++) {
+                        if (rhythm_step == segment) {
+                            out[i]      = 0;
+                            rhythm_step = 0;
+                        } else {
+                            out[i] = seq[seq_index];
+                            rhythm_step++;
+                            if (++seq_index == n)
+                                seq_index = 0;
+                        }
+                    }
+                }
+            });
+        }
+        else {
+            // Each segment is 2 * segment_length - 1 steps: forwards from the segment's own step,
+            // then back again.
+            size_t segment_length = n / 2 + 1;
+            size_t segment_size   = 2 * segment_length - 1;
+
+            parallel_for(n, grain_for(n, threads, 1), threads, [&](size_t first, size_t last) {
+                for (size_t segment = first; segment < last; segment++) {
+                    size_t start = segment * segment_size;
+                    size_t end   = std::min(start + segment_size, written);
+
+                    for (size_t i = start; i < end; i++) {
+                        size_t offset = i - start;
+                        if (offset >= segment_length)
+                            offset = segment_size - offset;
+                        out[i] = seq[(offset + segment) % n];
+                    }
+                }
+            });
+        }
+        return written;
+    }
+
+
+    size_t parallel_gather(std::span<const int32_t> seq, std::span<const int32_t> plan, std::span<int32_t> out, unsigned threads) {
+        size_t length = std::min(plan.size(), out.size());
+        if (threads <= 1 || length < parallel_threshold)
+            return gather(seq, plan, out);
+
+        parallel_for(length, grain_for(length, threads, 16384), threads, [&](size_t begin, size_t end) {
+            gather(seq, plan.subspan(begin, end - begin), out.subspan(begin, end - begin));
+        });
+        return length;
+    }
+
+}
@@ -0,0 +1,64 @@
+/// @file
+///	@ingroup   weft
+///	@copyright Copyright 2020 Stephen Meyer. All rights reserved.
+///	@licence	     Use of this source code is governed by the MIT License found in the License.md file.
+
+#pragma once
+
+#include "weft_core.h"
+
+
+// Parallel generation.
+//
+// Large outputs can be filled on several threads at once, each writing its own disjoint range of a
+// presized output buffer. The threads come from one work-stealing pool shared by every weft object
+// in the process, with a worker per hardware thread beyond the first. The thread that asks for the
+// work always takes part, so `threads` counts it too, but it only ever runs its own share: work
+// queued by other callers is left to the workers.
+//
+// Each copy of this library starts its own pool on first use. A host that loads several copies into
+// one process, as Max does with every external, makes one pool with make_thread_pool and hands it to
+// every copy with share_thread_pool before any of them runs parallel work.
+namespace weft {
+
+    class thread_pool;
+
+    // A new pool, which is never stopped: it is meant to live as long as the process.
+    thread_pool* make_thread_pool();
+
+    // Run every later parallel call on `pool` in place of this copy's own.
+    void share_thread_pool(thread_pool& pool);
+
+
+    // Outputs shorter than this are always generated on the calling thread alone, where splitting
+    // the work would cost more than it saves.
+    constexpr size_t parallel_threshold = 1 << 16;
+
+    // The number of hardware threads, used when an object asks for 0 threads.
+    unsigned hardware_threads();
+
+
+    // Run `body(begin, end)` over disjoint ranges covering [0, count), each at most `grain` long,
+    // on up to `threads` threads. Ranges are handed out as threads become free. Returns once every
+    // range is done.
+    using range_function = void (*)(void* context, size_t begin, size_t end);
+    void parallel_for(size_t count, size_t grain, unsigned threads, range_function body, void* context);
+
+    template<class body_function>
+    void parallel_for(size_t count, size_t grain, unsigned threads, body_function body) {
+        parallel_for(count, grain, threads, [](void* context, size_t begin, size_t end) {
+            (*static_cast<body_function*>(context))(begin, end);
+        }, &body);
+    }
+
+
+    // The transforms, filling disjoint ranges of `out` on up to `threads` threads once the output is
+    // at least parallel_threshold steps. Each writes exactly what its serial version writes.
+    size_t parallel_apply_rhythm(std::span<const int32_t> seq, std::span<const int32_t> rhythm, fill_mode mode, std::span<int32_t> out, unsigned threads);
+
+    // Melodies IV and XI are split by segment. Melodies XV and XVI are generated serially.
+    size_t parallel_apply_melody(melody which, std::span<const int32_t> seq, xv_shape shape, std::span<int32_t> out, unsigned threads);
+
+    size_t parallel_gather(std::span<const int32_t> seq, std::span<const int32_t> plan, std::span<int32_t> out, unsigned threads);
+
+}
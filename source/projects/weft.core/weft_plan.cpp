@@ -0,0 +1,319 @@
+/// @file
+///	@ingroup   weft
+///	@copyright Copyright 2020 Stephen Meyer. All rights reserved.
+///	@licence	     Use of this source code is governed by the MIT License found in the License.md file.
+
+#include "weft_plan.h"
+
+#include <algorithm>
+#include <atomic>
+#include <list>
+#include <mutex>
+#include <numeric>
+#include <unordered_map>
+
+
+namespace weft {
+
+    namespace {
+
+        enum class plan_kind { rhythm, repeats, melody, chain };
+
+
+        // Everything a plan depends on. `a`, `b` and `c` hold the transform's scalar parameters.
+        struct plan_key {
+            plan_kind            kind;
+            size_t               seq_size;
+            int64_t              a;
+            int64_t              b;
+            int64_t              c;
+            std::vector<int32_t> pattern;
+        };
+
+
+        // A key that borrows its pattern, so that looking a plan up doesn't allocate. The cache
+        // only copies the pattern into a plan_key when it stores a new plan.
+        struct plan_key_view {
+            plan_kind                kind;
+            size_t                   seq_size;
+            int64_t                  a;
+            int64_t                  b;
+            int64_t                  c;
+            std::span<const int32_t> pattern;
+
+            plan_key to_key() const {
+                return { kind, seq_size, a, b, c, {pattern.begin(), pattern.end()} };
+            }
+        };
+
+
+        // Hashing and comparison take either kind of key.
+        struct plan_key_hash {
+            using is_transparent = void;
+
+            template<class key_type>
+            size_t operator()(const key_type& key) const {
+                uint64_t hash = 14695981039346656037ull;
+                auto mix = [&hash](uint64_t value) {
+                    hash ^= value;
+                    hash *= 1099511628211ull;
+                };
+
+                mix(uint64_t(key.kind));
+                mix(key.seq_size);
+                mix(uint64_t(key.a));
+                mix(uint64_t(key.b));
+                mix(uint64_t(key.c));
+                for (int32_t step : key.pattern)
+                    mix(uint32_t(step));
+                return size_t(hash);
+            }
+        };
+
+
+        struct plan_key_equal {
+            using is_transparent = void;
+
+            template<class left_type, class right_type>
+            bool operator()(const left_type& left, const right_type& right) const {
+                return left.kind == right.kind && left.seq_size == right.seq_size && left.a == right.a && left.b == right.b && left.c == right.c
+                    && std::equal(left.pattern.begin(), left.pattern.end(), right.pattern.begin(), right.pattern.end());
+            }
+        };
+
+    }
+
+
+    class plan_cache {
+    public:
+        // Return the cached plan for `key`, or build one of `length` steps with `build` and
+        // cache it. Returns nullptr if the plan would be larger than the whole budget.
+        template<class build_function>
+        std::shared_ptr<const index_plan> find_or_build(plan_key_view key, size_t length, build_function build) {
+            {
+                std::lock_guard<std::mutex> lock {m_mutex};
+
+                if (length > m_budget / sizeof(int32_t))
+                    return nullptr;
+
+                auto found = m_plans.find(key);
+                if (found != m_plans.end()) {
+                    m_recent.splice(m_recent.begin(), m_recent, found->second.recent);
+                    return found->second.plan;
+                }
+            }
+
+            // Build without holding the lock, so objects with other shapes aren't held up.
+            auto plan = std::make_shared<index_plan>(length);
+            build(*plan);
+
+            std::lock_guard<std::mutex> lock {m_mutex};
+
+            auto found = m_plans.find(key);
+            if (found != m_plans.end())
+                return found->second.plan;
+
+            m_recent.push_front(key.to_key());
+            m_plans.emplace(m_recent.front(), entry { plan, m_recent.begin() });
+            m_bytes += plan->size() * sizeof(int32_t);
+            evict();
+            return plan;
+        }
+
+
+        void set_budget(size_t bytes) {
+            std::lock_guard<std::mutex> lock {m_mutex};
+            m_budget = bytes;
+            evict();
+        }
+
+
+        size_t bytes() {
+            std::lock_guard<std::mutex> lock {m_mutex};
+            return m_bytes;
+        }
+
+
+        void clear() {
+            std::lock_guard<std::mutex> lock {m_mutex};
+            m_plans.clear();
+            m_recent.clear();
+            m_bytes = 0;
+        }
+
+    private:
+        struct entry {
+            std::shared_ptr<const index_plan>   plan;
+            std::list<plan_key>::iterator       recent;
+        };
+
+        // Plans still in use by an object stay alive after eviction; they are only dropped
+        // from the cache.
+        void evict() {
+            while (m_bytes > m_budget && !m_recent.empty()) {
+                auto found = m_plans.find(m_recent.back());
+                m_bytes -= found->second.plan->size() * sizeof(int32_t);
+                m_plans.erase(found);
+                m_recent.pop_back();
+            }
+        }
+
+        std::mutex                                          m_mutex;
+        std::unordered_map<plan_key, entry, plan_key_hash, plan_key_equal> m_plans;
+        std::list<plan_key>                                 m_recent;       // most recently used first
+        size_t                                              m_bytes {0};
+        size_t                                              m_budget {64 * 1024 * 1024};
+    };
+
+
+    namespace {
+
+        std::atomic<plan_cache*> shared_cache {nullptr};
+
+
+        // The cache handed to share_plan_cache, or else this copy's own.
+        plan_cache& cache() {
+            if (plan_cache* shared = shared_cache.load(std::memory_order_acquire))
+                return *shared;
+
+            static plan_cache own;
+            return own;
+        }
+
+
+        // A plan is the transform applied to the sequence 1, 2, ... n: each output value is one
+        // past the sequence step it came from, and rests come out as 0. Shifting down by one gives
+        // the indices, with rests at rest_index.
+        template<class transform_function>
+        void build_plan(size_t seq_size, index_plan& plan, transform_function transform) {
+            std::vector<int32_t> positions(seq_size);
+            std::iota(positions.begin(), positions.end(), 1);
+
+            transform(std::span<const int32_t>(positions), std::span<int32_t>(plan));
+
+            for (int32_t& index : plan)
+                index -= 1;
+        }
+
+    }
+
+
+    std::shared_ptr<const index_plan> rhythm_plan(size_t seq_size, std::span<const int32_t> rhythm, fill_mode mode, int length) {
+        size_t plan_length = rhythm_length(seq_size, rhythm, length);
+
+        plan_key_view key { plan_kind::rhythm, seq_size, int64_t(mode), length, 0, rhythm };
+        return cache().find_or_build(key, plan_length, [&](index_plan& plan) {
+            build_plan(seq_size, plan, [&](std::span<const int32_t> positions, std::span<int32_t> out) {
+                apply_rhythm(positions, rhythm, mode, out);
+            });
+        });
+    }
+
+
+    std::shared_ptr<const index_plan> repeats_plan(size_t seq_size, std::span<const int32_t> repeats) {
+        size_t plan_length = repeats_length(seq_size, repeats);
+
+        plan_key_view key { plan_kind::repeats, seq_size, 0, 0, 0, repeats };
+        return cache().find_or_build(key, plan_length, [&](index_plan& plan) {
+            build_plan(seq_size, plan, [&](std::span<const int32_t> positions, std::span<int32_t> out) {
+                apply_repeats(positions, repeats, out);
+            });
+        });
+    }
+
+
+    std::shared_ptr<const index_plan> melody_plan(melody which, size_t seq_size, xv_shape shape) {
+        size_t plan_length = melody_length(which, seq_size, shape);
+
+        plan_key_view key { plan_kind::melody, seq_size, int64_t(which), int64_t(shape.period), int64_t(shape.base), {} };
+        return cache().find_or_build(key, plan_length, [&](index_plan& plan) {
+            build_plan(seq_size, plan, [&](std::span<const int32_t> positions, std::span<int32_t> out) {
+                apply_melody(which, positions, shape, out);
+            });
+        });
+    }
+
+
+    std::shared_ptr<const index_plan> chain_plan(size_t seq_size, std::span<const stage> stages, const chain_patterns& patterns) {
+        if (std::find(stages.begin(), stages.end(), stage::shifter) != stages.end())
+            return nullptr;
+
+        size_t plan_length = chain_length(seq_size, stages, patterns);
+
+        // The key's one pattern holds the stages and then each pattern they use, each led by its
+        // length so that different chains can't run together into the same key.
+        thread_local std::vector<int32_t> shape;
+        shape.assign(1, int32_t(stages.size()));
+        for (stage kind : stages)
+            shape.push_back(int32_t(kind));
+        for (std::span<const int32_t> pattern : { patterns.rhythm, patterns.repeats, patterns.gates }) {
+            shape.push_back(int32_t(pattern.size()));
+            shape.insert(shape.end(), pattern.begin(), pattern.end());
+        }
+
+        plan_key_view key { plan_kind::chain, seq_size, int64_t(patterns.mode), patterns.length, 0, shape };
+        return cache().find_or_build(key, plan_length, [&](index_plan& plan) {
+            build_plan(seq_size, plan, [&](std::span<const int32_t> positions, std::span<int32_t> out) {
+                std::vector<int32_t> result;
+                std::vector<int32_t> scratch;
+                run_chain(positions, stages, patterns, result, scratch);
+                std::copy(result.begin(), result.end(), out.begin());
+            });
+        });
+    }
+
+
+    size_t gather(std::span<const int32_t> seq, std::span<const int32_t> plan, std::span<int32_t> out) {
+        size_t length = std::min(plan.size(), out.size());
+        for (size_t i = 0; i < length; i++)
+            out[i] = plan[i] == rest_index ? 0 : seq[plan[i]];
+        return length;
+    }
+
+
+    // A counting sort of the output steps by the sequence step they play: count each step's
+    // positions, turn the counts into offsets, then place the positions in output order.
+    plan_inverse::plan_inverse(std::span<const int32_t> plan, size_t seq_size)
+    : m_offsets(seq_size + 1, 0)
+    {
+        for (int32_t index : plan) {
+            if (index != rest_index)
+                m_offsets[size_t(index) + 1]++;
+        }
+        for (size_t i = 0; i < seq_size; i++)
+            m_offsets[i + 1] += m_offsets[i];
+
+        m_positions.resize(m_offsets[seq_size]);
+        std::vector<size_t> next(m_offsets.begin(), m_offsets.end() - 1);
+        for (size_t i = 0; i < plan.size(); i++) {
+            if (plan[i] != rest_index)
+                m_positions[next[size_t(plan[i])]++] = i;
+        }
+    }
+
+
+    plan_cache* make_plan_cache() {
+        return new plan_cache;
+    }
+
+
+    void share_plan_cache(plan_cache& cache) {
+        shared_cache.store(&cache, std::memory_order_release);
+    }
+
+
+    void set_plan_cache_budget(size_t bytes) {
+        cache().set_budget(bytes);
+    }
+
+
+    size_t plan_cache_bytes() {
+        return cache().bytes();
+    }
+
+
+    void clear_plan_cache() {
+        cache().clear();
+    }
+
+}
@@ -0,0 +1,79 @@
+/// @file
+///	@ingroup   weft
+///	@copyright Copyright 2020 Stephen Meyer. All rights reserved.
+///	@licence	     Use of this source code is governed by the MIT License found in the License.md file.
+
+#pragma once
+
+#include "weft_chain.h"
+#include "weft_core.h"
+
+#include <memory>
+
+
+// Index plans.
+//
+// The rhythm, repeater and rational melody transforms only move sequence steps around: which
+// sequence step lands at each output step depends on the sequence's length and the patterns, never
+// on the values in the sequence. An index plan records that mapping once so that a transform becomes
+// a single gather from the sequence. Plans are cached for the whole process, keyed by transform,
+// sequence length and patterns, so every object with the same shape shares one.
+//
+// Each copy of this library starts with a cache of its own. A host that loads several copies into
+// one process, as Max does with every external, makes one cache with make_plan_cache and hands it
+// to every copy with share_plan_cache before any of them makes a plan, so that they share both the
+// plans and the budget.
+namespace weft {
+
+    using index_plan = std::vector<int32_t>;
+
+    // The plan entry for an output step that is a rest (0) rather than a sequence step.
+    constexpr int32_t rest_index = -1;
+
+
+    // Each returns the shared plan for a transform, building and caching it on first use. Returns
+    // nullptr when the plan would not fit in the cache budget, in which case the caller should run
+    // the transform directly.
+    std::shared_ptr<const index_plan> rhythm_plan(size_t seq_size, std::span<const int32_t> rhythm, fill_mode mode, int length);
+    std::shared_ptr<const index_plan> repeats_plan(size_t seq_size, std::span<const int32_t> repeats);
+    std::shared_ptr<const index_plan> melody_plan(melody which, size_t seq_size, xv_shape shape = {});
+
+    // A chain's stages together are a plan too, as long as none is a shifter stage, whose output
+    // depends on the values in the sequence. Returns nullptr for a chain with one.
+    std::shared_ptr<const index_plan> chain_plan(size_t seq_size, std::span<const stage> stages, const chain_patterns& patterns);
+
+    // Write seq[plan[i]] (or 0 for a rest) to each output step. Returns the number of steps written.
+    size_t gather(std::span<const int32_t> seq, std::span<const int32_t> plan, std::span<int32_t> out);
+
+    // A plan turned around: for each sequence step, the output steps that play it. These are the
+    // only steps a change to that one sequence step changes.
+    class plan_inverse {
+    public:
+        plan_inverse() = default;
+        plan_inverse(std::span<const int32_t> plan, size_t seq_size);
+
+        // The output steps that play sequence step `index`, in order.
+        std::span<const size_t> positions(size_t index) const {
+            return { m_positions.data() + m_offsets[index], m_offsets[index + 1] - m_offsets[index] };
+        }
+
+    private:
+        std::vector<size_t> m_offsets;      // where each sequence step's positions start, and one past the last
+        std::vector<size_t> m_positions;
+    };
+
+
+    class plan_cache;
+
+    // A new, empty cache, meant to live as long as the process.
+    plan_cache* make_plan_cache();
+
+    // Keep every later plan in `cache` in place of this copy's own.
+    void share_plan_cache(plan_cache& cache);
+
+    // Plans are evicted least recently used first once their total size exceeds the budget.
+    void   set_plan_cache_budget(size_t bytes);
+    size_t plan_cache_bytes();
+    void   clear_plan_cache();
+
+}
@@ -0,0 +1,332 @@
+/// @file
+///	@ingroup   weft
+///	@copyright Copyright 2020 Stephen Meyer. All rights reserved.
+///	@licence	     Use of this source code is governed by the MIT License found in the License.md file.
+
+#include "weft_simd.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+
+// The vector kernels are compiled with per-function target attributes so that the rest of the
+// library keeps the baseline instruction set. Other compilers and CPUs get the scalar kernels.
+#if (defined(__x86_64__) || defined(_M_X64)) && (defined(__GNUC__) || defined(__clang__))
+    #define WEFT_SIMD_X86 1
+    #include <immintrin.h>
+#else
+    #define WEFT_SIMD_X86 0
+#endif
+
+
+namespace weft {
+
+    namespace {
+
+        // A kernel transforms n steps of the sequence against n steps of the pattern, already
+        // lined up with them, so it needs no modulo.
+        using kernel_function = void (*)(const int32_t* seq, const int32_t* pattern, int32_t* out, size_t n);
+
+
+        // Shifts wrap on overflow, as the vector kernels do, rather than being undefined.
+        void shifts_scalar(const int32_t* seq, const int32_t* shifts, int32_t* out, size_t n) {
+            for (size_t i = 0; i < n; i++)
+                out[i] = seq[i] == 0 ? 0 : int32_t(uint32_t(seq[i]) + uint32_t(shifts[i]));
+        }
+
+
+        void gates_scalar(const int32_t* seq, const int32_t* gates, int32_t* out, size_t n) {
+            for (size_t i = 0; i < n; i++)
+                out[i] = gates[i] == 0 ? 0 : seq[i];
+        }
+
+
+        // A diff kernel appends `offset + i` to `changed` for each of n steps where the two
+        // outputs differ.
+        using diff_function = void (*)(const int32_t* previous, const int32_t* next, size_t n, size_t offset, std::vector<size_t>& changed);
+
+
+        void diff_scalar(const int32_t* previous, const int32_t* next, size_t n, size_t offset, std::vector<size_t>& changed) {
+            for (size_t i = 0; i < n; i++) {
+                if (previous[i] != next[i])
+                    changed.push_back(offset + i);
+            }
+        }
+
+
+#if WEFT_SIMD_X86
+
+        // Append the lanes set in `mask` as indices from `first`.
+        void push_lanes(unsigned mask, size_t first, std::vector<size_t>& changed) {
+            for (; mask != 0; mask &= mask - 1)
+                changed.push_back(first + std::countr_zero(mask));
+        }
+
+
+        __attribute__((target("sse4.2")))
+        void shifts_sse42(const int32_t* seq, const int32_t* shifts, int32_t* out, size_t n) {
+            const __m128i zero = _mm_setzero_si128();
+            size_t        i    = 0;
+
+            for (; i + 4 <= n; i += 4) {
+                __m128i steps = _mm_loadu_si128(reinterpret_cast<const __m128i*>(seq + i));
+                __m128i shift = _mm_loadu_si128(reinterpret_cast<const __m128i*>(shifts + i));
+                __m128i rests = _mm_cmpeq_epi32(steps, zero);
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_add_epi32(steps, _mm_andnot_si128(rests, shift)));
+            }
+            shifts_scalar(seq + i, shifts + i, out + i, n - i);
+        }
+
+
+        __attribute__((target("sse4.2")))
+        void gates_sse42(const int32_t* seq, const int32_t* gates, int32_t* out, size_t n) {
+            const __m128i zero = _mm_setzero_si128();
+            size_t        i    = 0;
+
+            for (; i + 4 <= n; i += 4) {
+                __m128i steps  = _mm_loadu_si128(reinterpret_cast<const __m128i*>(seq + i));
+                __m128i gate   = _mm_loadu_si128(reinterpret_cast<const __m128i*>(gates + i));
+                __m128i closed = _mm_cmpeq_epi32(gate, zero);
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_andnot_si128(closed, steps));
+            }
+            gates_scalar(seq + i, gates + i, out + i, n - i);
+        }
+
+
+        __attribute__((target("sse4.2")))
+        void diff_sse42(const int32_t* previous, const int32_t* next, size_t n, size_t offset, std::vector<size_t>& changed) {
+            size_t i = 0;
+
+            for (; i + 4 <= n; i += 4) {
+                __m128i before = _mm_loadu_si128(reinterpret_cast<const __m128i*>(previous + i));
+                __m128i after  = _mm_loadu_si128(reinterpret_cast<const __m128i*>(next + i));
+                unsigned same  = unsigned(_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(before, after))));
+                push_lanes(~same & 0xF, offset + i, changed);
+            }
+            diff_scalar(previous + i, next + i, n - i, offset + i, changed);
+        }
+
+
+        __attribute__((target("avx2")))
+        void shifts_avx2(const int32_t* seq, const int32_t* shifts, int32_t* out, size_t n) {
+            const __m256i zero = _mm256_setzero_si256();
+            size_t        i    = 0;
+
+            for (; i + 8 <= n; i += 8) {
+                __m256i steps = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(seq + i));
+                __m256i shift = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(shifts + i));
+                __m256i rests = _mm256_cmpeq_epi32(steps, zero);
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), _mm256_add_epi32(steps, _mm256_andnot_si256(rests, shift)));
+            }
+            shifts_scalar(seq + i, shifts + i, out + i, n - i);
+        }
+
+
+        __attribute__((target("avx2")))
+        void gates_avx2(const int32_t* seq, const int32_t* gates, int32_t* out, size_t n) {
+            const __m256i zero = _mm256_setzero_si256();
+            size_t        i    = 0;
+
+            for (; i + 8 <= n; i += 8) {
+                __m256i steps  = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(seq + i));
+                __m256i gate   = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(gates + i));
+                __m256i closed = _mm256_cmpeq_epi32(gate, zero);
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), _mm256_andnot_si256(closed, steps));
+            }
+            gates_scalar(seq + i, gates + i, out + i, n - i);
+        }
+
+
+        __attribute__((target("avx2")))
+        void diff_avx2(const int32_t* previous, const int32_t* next, size_t n, size_t offset, std::vector<size_t>& changed) {
+            size_t i = 0;
+
+            for (; i + 8 <= n; i += 8) {
+                __m256i before = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(previous + i));
+                __m256i after  = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(next + i));
+                unsigned same  = unsigned(_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(before, after))));
+                push_lanes(~same & 0xFF, offset + i, changed);
+            }
+            diff_scalar(previous + i, next + i, n - i, offset + i, changed);
+        }
+
+
+        __attribute__((target("avx512f")))
+        void shifts_avx512(const int32_t* seq, const int32_t* shifts, int32_t* out, size_t n) {
+            size_t i = 0;
+
+            for (; i + 16 <= n; i += 16) {
+                __m512i   steps = _mm512_loadu_si512(seq + i);
+                __m512i   shift = _mm512_loadu_si512(shifts + i);
+                __mmask16 hits  = _mm512_test_epi32_mask(steps, steps);
+                _mm512_storeu_si512(out + i, _mm512_mask_add_epi32(steps, hits, steps, shift));
+            }
+            shifts_scalar(seq + i, shifts + i, out + i, n - i);
+        }
+
+
+        __attribute__((target("avx512f")))
+        void gates_avx512(const int32_t* seq, const int32_t* gates, int32_t* out, size_t n) {
+            size_t i = 0;
+
+            for (; i + 16 <= n; i += 16) {
+                __m512i   steps = _mm512_loadu_si512(seq + i);
+                __m512i   gate  = _mm512_loadu_si512(gates + i);
+                __mmask16 open  = _mm512_test_epi32_mask(gate, gate);
+                _mm512_storeu_si512(out + i, _mm512_maskz_mov_epi32(open, steps));
+            }
+            gates_scalar(seq + i, gates + i, out + i, n - i);
+        }
+
+
+
+        __attribute__((target("avx512f")))
+        void diff_avx512(const int32_t* previous, const int32_t* next, size_t n, size_t offset, std::vector<size_t>& changed) {
+            size_t i = 0;
+
+            for (; i + 16 <= n; i += 16) {
+                __m512i before = _mm512_loadu_si512(previous + i);
+                __m512i after  = _mm512_loadu_si512(next + i);
+                push_lanes(_mm512_cmpneq_epi32_mask(before, after), offset + i, changed);
+            }
+            diff_scalar(previous + i, next + i, n - i, offset + i, changed);
+        }
+
+#endif
+
+
+        simd_level detect_simd_level() {
+#if WEFT_SIMD_X86
+            __builtin_cpu_init();
+            if (__builtin_cpu_supports("avx512f"))
+                return simd_level::avx512;
+            if (__builtin_cpu_supports("avx2"))
+                return simd_level::avx2;
+            if (__builtin_cpu_supports("sse4.2"))
+                return simd_level::sse42;
+#endif
+            return simd_level::scalar;
+        }
+
+
+        std::atomic<simd_level>& active_level() {
+            static std::atomic<simd_level> level { best_simd_level() };
+            return level;
+        }
+
+
+        kernel_function shifts_kernel() {
+            switch (active_level().load(std::memory_order_relaxed)) {
+#if WEFT_SIMD_X86
+                case simd_level::avx512: return shifts_avx512;
+                case simd_level::avx2:   return shifts_avx2;
+                case simd_level::sse42:  return shifts_sse42;
+#endif
+                default:                 return shifts_scalar;
+            }
+        }
+
+
+        kernel_function gates_kernel() {
+            switch (active_level().load(std::memory_order_relaxed)) {
+#if WEFT_SIMD_X86
+                case simd_level::avx512: return gates_avx512;
+                case simd_level::avx2:   return gates_avx2;
+                case simd_level::sse42:  return gates_sse42;
+#endif
+                default:                 return gates_scalar;
+            }
+        }
+
+
+        diff_function diff_kernel() {
+            switch (active_level().load(std::memory_order_relaxed)) {
+#if WEFT_SIMD_X86
+                case simd_level::avx512: return diff_avx512;
+                case simd_level::avx2:   return diff_avx2;
+                case simd_level::sse42:  return diff_sse42;
+#endif
+                default:                 return diff_scalar;
+            }
+        }
+
+
+        // Patterns shorter than this are tiled on the stack up to at least this many steps, so
+        // that each kernel call covers a long run of the sequence however short the pattern is.
+        constexpr size_t min_run = 256;
+
+
+        // Run `kernel` over the sequence with the pattern cycled beneath it. Each kernel call
+        // covers one whole cycle of the (tiled) pattern.
+        size_t apply_cycled(kernel_function kernel, std::span<const int32_t> seq, std::span<const int32_t> pattern, std::span<int32_t> out) {
+            size_t length = std::min(seq.size(), out.size());
+
+            if (pattern.empty()) {
+                std::copy_n(seq.begin(), length, out.begin());
+                return length;
+            }
+
+            std::array<int32_t, 2 * min_run> tiled;
+            std::span<const int32_t>         cycle = pattern;
+
+            if (pattern.size() < min_run && pattern.size() < length) {
+                size_t cycles = (std::min(min_run, length) + pattern.size() - 1) / pattern.size();
+                for (size_t c = 0; c < cycles; c++)
+                    std::copy(pattern.begin(), pattern.end(), tiled.begin() + c * pattern.size());
+                cycle = std::span<const int32_t>(tiled.data(), cycles * pattern.size());
+            }
+
+            for (size_t i = 0; i < length; i += cycle.size())
+                kernel(seq.data() + i, cycle.data(), out.data() + i, std::min(cycle.size(), length - i));
+            return length;
+        }
+
+    }
+
+
+    size_t apply_shifts(std::span<const int32_t> seq, std::span<const int32_t> shifts, std::span<int32_t> out) {
+        return apply_cycled(shifts_kernel(), seq, shifts, out);
+    }
+
+
+    size_t apply_gates(std::span<const int32_t> seq, std::span<const int32_t> gates, std::span<int32_t> out) {
+        return apply_cycled(gates_kernel(), seq, gates, out);
+    }
+
+
+    void changed_steps(std::span<const int32_t> previous, std::span<const int32_t> next, std::vector<size_t>& changed) {
+        size_t common = std::min(previous.size(), next.size());
+
+        diff_kernel()(previous.data(), next.data(), common, 0, changed);
+        for (size_t i = common; i < next.size(); i++)
+            changed.push_back(i);
+    }
+
+
+    simd_level best_simd_level() {
+        static const simd_level best = detect_simd_level();
+        return best;
+    }
+
+
+    simd_level current_simd_level() {
+        return active_level().load(std::memory_order_relaxed);
+    }
+
+
+    void set_simd_level(simd_level level) {
+        active_level().store(level <= best_simd_level() ? level : best_simd_level(), std::memory_order_relaxed);
+    }
+
+
+    const char* simd_level_name(simd_level level) {
+        switch (level) {
+            case simd_level::sse42:  return "sse4.2";
+            case simd_level::avx2:   return "avx2";
+            case simd_level::avx512: return "avx512";
+            default:                 return "scalar";
+        }
+    }
+
+}
@@ -0,0 +1,31 @@
+/// @file
+///	@ingroup   weft
+///	@copyright Copyright 2020 Stephen Meyer. All rights reserved.
+///	@licence	     Use of this source code is governed by the MIT License found in the License.md file.
+
+#pragma once
+
+#include "weft_core.h"
+
+
+// Vector kernels.
+//
+// apply_shifts, apply_gates and changed_steps run on the widest instruction set the CPU supports, chosen once at
+// startup on x86-64 and falling back to scalar code elsewhere. The level can be lowered to compare
+// kernels, as weft.bench does.
+namespace weft {
+
+    enum class simd_level { scalar, sse42, avx2, avx512 };
+
+    // The widest level supported by this CPU and build.
+    simd_level best_simd_level();
+
+    // The level the vector kernels run at, best_simd_level() unless changed.
+    simd_level current_simd_level();
+
+    // Run at `level`, or at best_simd_level() if the CPU does not support it.
+    void set_simd_level(simd_level level);
+
+    const char* simd_level_name(simd_level level);
+
+}
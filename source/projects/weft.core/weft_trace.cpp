@@ -0,0 +1,246 @@
+/// @file
+///	@ingroup   weft
+///	@copyright Copyright 2020 Stephen Meyer. All rights reserved.
+///	@licence	     Use of this source code is governed by the MIT License found in the License.md file.
+
+#include "weft_trace.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <thread>
+#include <vector>
+
+
+namespace weft {
+
+    namespace {
+
+        // One event in a ring.
+        struct slot {
+            static constexpr uint64_t busy = UINT64_MAX;
+
+            std::atomic<uint64_t>    index  {busy};
+            std::atomic<const char*> name   {nullptr};
+            std::atomic<int64_t>     time   {0};
+            std::atomic<char>        phase  {0};
+            std::atomic<unsigned>    thread {0};
+        };
+
+
+        struct event {
+            const char* name;
+            int64_t     time;
+            char        phase;
+            unsigned    thread;
+        };
+
+
+        void write_escaped(std::ostream& out, const char* text) {
+            for (; *text; text++) {
+                if (*text == '"' || *text == '\\')
+                    out << '\\';
+                out << *text;
+            }
+        }
+
+    }
+
+
+    // The events of whichever thread holds the ring. Only that thread writes to it, and readers
+    // hold the tracer's mutex, so each slot needs only to tell a reader whether the event it read
+    // was overwritten under it: a slot is marked busy while it is written, then tagged with the
+    // event's index. Each ring has a cache line to itself, as its thread writes to it on every
+    // event.
+    struct alignas(64) tracer::ring {
+        std::atomic<std::thread::id> holder;                // no thread while the ring is free
+        unsigned                     thread  {0};           // the holder's number on the timeline
+        std::atomic<bool>            active  {false};       // set while the holder records an event
+        std::atomic<uint64_t>        written {0};
+        uint64_t                     read    {0};
+    };
+
+
+    // Every ring, and while tracing one allocation of slots between them.
+    struct tracer::pool {
+        ~pool() {
+            delete[] slots.load();
+        }
+
+        ring                  rings[ring_count];
+        std::atomic<slot*>    slots       {nullptr};        // ring i's start at i * ring_capacity
+        std::atomic<unsigned> next_thread {1};
+    };
+
+
+    // The ring a thread holds, handed back when the thread exits. Each external has its own copy
+    // of this code, and so its own lease, but a thread holds a single ring in a pool whichever copy
+    // it records through: each looks for a ring the thread already holds before taking another.
+    struct tracer::lease {
+        ~lease() {
+            release();
+        }
+
+        void release() {
+            std::thread::id self = std::this_thread::get_id();
+            if (held)
+                held->holder.compare_exchange_strong(self, std::thread::id {}, std::memory_order_acq_rel);
+            held = nullptr;
+            owner.reset();
+        }
+
+        std::shared_ptr<pool> owner;
+        ring*                 held {nullptr};
+    };
+
+
+    tracer::tracer()
+    : m_epoch(clock::now())
+    , m_pool(std::make_shared<pool>())
+    {}
+
+
+    tracer::~tracer() = default;
+
+
+    void tracer::enable(bool on) {
+        std::lock_guard<std::mutex> lock {m_mutex};
+
+        if (on && !m_pool->slots.load())
+            m_pool->slots.store(new slot[ring_count * ring_capacity]);
+        m_enabled.store(on, std::memory_order_relaxed);
+    }
+
+
+    tracer::ring* tracer::thread_ring() {
+        thread_local lease own;
+
+        std::thread::id self = std::this_thread::get_id();
+        if (own.owner == m_pool && own.held->holder.load(std::memory_order_relaxed) == self)
+            return own.held;
+
+        // The thread may hold a ring through another copy of this code; otherwise it takes a free
+        // one and a number of its own.
+        pool& shared = *m_pool;
+        ring* found  = nullptr;
+        for (ring& each : shared.rings) {
+            if (each.holder.load(std::memory_order_acquire) == self) {
+                found = &each;
+                break;
+            }
+        }
+        for (size_t i = 0; !found && i < ring_count; i++) {
+            std::thread::id free;
+            if (shared.rings[i].holder.compare_exchange_strong(free, self, std::memory_order_acq_rel)) {
+                found         = &shared.rings[i];
+                found->thread = shared.next_thread.fetch_add(1);
+            }
+        }
+        if (!found)
+            return nullptr;
+
+        own.release();
+        own.owner = m_pool;
+        own.held  = found;
+        return found;
+    }
+
+
+    void tracer::record(const char* name, char phase) {
+        // Nothing to record into, and no ring worth taking, until tracing starts.
+        if (!m_pool->slots.load(std::memory_order_relaxed))
+            return;
+
+        int64_t time = std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - m_epoch).count();
+        ring*   own  = thread_ring();
+        if (!own)
+            return;
+
+        // While active is set, clear won't free the slots; it sets slots to nullptr before it
+        // waits, so this either sees that or is waited for.
+        own->active.store(true);
+        if (slot* slots = m_pool->slots.load()) {
+            uint64_t index = own->written.load(std::memory_order_relaxed);
+            slot&    each  = slots[size_t(own - m_pool->rings) * ring_capacity + index % ring_capacity];
+
+            each.index.store(slot::busy, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            each.name.store(name, std::memory_order_relaxed);
+            each.time.store(time, std::memory_order_relaxed);
+            each.phase.store(phase, std::memory_order_relaxed);
+            each.thread.store(own->thread, std::memory_order_relaxed);
+            each.index.store(index, std::memory_order_release);
+
+            own->written.store(index + 1, std::memory_order_release);
+        }
+        own->active.store(false, std::memory_order_release);
+    }
+
+
+    size_t tracer::write_json(std::ostream& out) {
+        std::lock_guard<std::mutex> lock {m_mutex};
+
+        std::vector<event> events;
+        if (slot* slots = m_pool->slots.load()) {
+            for (size_t i = 0; i < ring_count; i++) {
+                ring&    each    = m_pool->rings[i];
+                uint64_t written = each.written.load(std::memory_order_acquire);
+                uint64_t first   = std::max(each.read, written > ring_capacity ? written - ring_capacity : 0);
+
+                for (uint64_t index = first; index < written; index++) {
+                    slot& source = slots[i * ring_capacity + index % ring_capacity];
+                    if (source.index.load(std::memory_order_acquire) != index)
+                        continue;
+
+                    event read { source.name.load(std::memory_order_relaxed), source.time.load(std::memory_order_relaxed),
+                                 source.phase.load(std::memory_order_relaxed), source.thread.load(std::memory_order_relaxed) };
+
+                    // Skip the event if its thread has since started overwriting the slot.
+                    std::atomic_thread_fence(std::memory_order_acquire);
+                    if (source.index.load(std::memory_order_relaxed) == index)
+                        events.push_back(read);
+                }
+                each.read = written;
+            }
+        }
+
+        std::stable_sort(events.begin(), events.end(), [](const event& a, const event& b) { return a.time < b.time; });
+
+        // Timestamps are in microseconds, to the nanosecond.
+        out << "{\"traceEvents\":[";
+        for (size_t i = 0; i < events.size(); i++) {
+            const event& each = events[i];
+
+            out << (i == 0 ? "\n" : ",\n") << "{\"name\":\"";
+            write_escaped(out, each.name);
+            out << "\",\"cat\":\"weft\",\"ph\":\"" << each.phase << "\",\"ts\":" << each.time / 1000 << '.'
+                << std::setw(3) << std::setfill('0') << each.time % 1000 << std::setfill(' ')
+                << ",\"pid\":1,\"tid\":" << each.thread << '}';
+        }
+        out << "\n],\"displayTimeUnit\":\"ns\"}\n";
+
+        return events.size();
+    }
+
+
+    void tracer::clear() {
+        std::lock_guard<std::mutex> lock {m_mutex};
+
+        if (enabled()) {
+            for (ring& each : m_pool->rings)
+                each.read = each.written.load(std::memory_order_acquire);
+            return;
+        }
+
+        // Stopped, so free the slots once no thread is still recording into them. Rings stay held
+        // by their threads, and start again from the beginning of the next allocation.
+        slot* slots = m_pool->slots.exchange(nullptr);
+        for (ring& each : m_pool->rings) {
+            while (each.active.load())
+                std::this_thread::yield();
+            each.written.store(0, std::memory_order_relaxed);
+            each.read = 0;
+        }
+        delete[] slots;
+    }
+
+}
@@ -0,0 +1,82 @@
+/// @file
+///	@ingroup   weft
+///	@copyright Copyright 2020 Stephen Meyer. All rights reserved.
+///	@licence	     Use of this source code is governed by the MIT License found in the License.md file.
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+
+
+// Tracing.
+//
+// A tracer collects timestamped begin and end events from any number of threads and writes them
+// out as Chrome trace-event JSON, which chrome://tracing and Perfetto show on a timeline. Each
+// thread records into a ring buffer it holds in a fixed pool, so recording takes no lock and never
+// waits on another thread; once a ring is full its oldest events are overwritten. The pool is
+// allocated when tracing starts and freed by a clear once it has stopped, and a thread hands its
+// ring back when it exits. Event names are never copied, so they must outlive the tracer, as
+// string literals do.
+namespace weft {
+
+    class tracer {
+    public:
+        // The most threads that can record at once, and the number of events each one's ring
+        // holds. A thread that finds every ring held records nothing.
+        static constexpr size_t ring_count    = 64;
+        static constexpr size_t ring_capacity = 1 << 13;
+
+        tracer();
+        ~tracer();
+
+        tracer(const tracer&)            = delete;
+        tracer& operator=(const tracer&) = delete;
+
+
+        bool enabled() const {
+            return m_enabled.load(std::memory_order_relaxed);
+        }
+
+        // Starting allocates the pool, if a clear has freed it or it has never been allocated.
+        void enable(bool on);
+
+
+        // Record an event on the calling thread, whether or not tracing is enabled, as long as the
+        // pool is allocated.
+        void begin(const char* name) { record(name, 'B'); }
+        void end(const char* name)   { record(name, 'E'); }
+
+
+        // Write every event recorded since the last write or clear as a trace-event JSON document,
+        // and drop them. Returns the number of events written.
+        size_t write_json(std::ostream& out);
+
+        // Drop every event recorded so far, and free the pool if tracing is stopped.
+        void clear();
+
+    private:
+        struct ring;
+        struct pool;
+        struct lease;
+        using clock = std::chrono::steady_clock;
+
+        void  record(const char* name, char phase);
+        ring* thread_ring();
+
+        std::atomic<bool>                  m_enabled {false};
+        const clock::time_point            m_epoch;
+
+        // Shared with every thread holding one of its rings, so that a thread exiting after the
+        // tracer is gone can still hand its ring back.
+        const std::shared_ptr<pool>        m_pool;
+
+        // Held while starting, writing or clearing, the only times the pool is allocated or read.
+        std::mutex                         m_mutex;
+    };
+
+}
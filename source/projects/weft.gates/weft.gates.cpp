@@ -9,7 +9,7 @@
 using namespace c74::min;
 
 
-class gates : public object<gates> {
+class gates : public sequence_object<gates> {
 public:
     MIN_DESCRIPTION {"Transform a sequence by applying a gate pattern."};
     MIN_TAGS        {"sequences, transformations"};
@@ -17,53 +17,223 @@ public:
     MIN_RELATED     {"zl"};
 
 
-    inlet<>  input  { this, "(bang) send out transformed sequence" };
-    outlet<> output { this, "(list) the transformed sequence as a list." };
+    inlet<>       input        { this, "(bang) send out transformed sequence" };
+    traced_outlet output       { this, "weft.gates output", "(list) the transformed sequence as a list." };
+    traced_outlet stats_output { this, "weft.gates stats_output", "(dictionary) performance statistics, in reply to stats." };
 
 
+private:
+    friend class sequence_object<gates>;
+
+    static constexpr const char* class_name = "weft.gates";
+
+    // Everything the transform depends on, published as a whole whenever an attribute changes so
+    // that bang never waits on a setter. The transformed sequence and stepper are computed at
+    // most once per state.
+    struct state {
+        shared_steps sequence { make_steps({0}) };
+        shared_steps gates    { make_steps({1}) };
+
+        lazy<atoms>               output;
+        lazy<weft::gates_stepper> stepper;
+    };
+
+    snapshot<state> m_state { state {} };
+
+    // Counters for the stats message, recorded by bang.
+    bang_stats m_stats;
+
+    // The output last sent, for @output delta.
+    output_delta m_delta;
+
+    // The steps bang generates before they become atoms.
+    step_buffer m_output_seq;
+
+
+public:
     attribute< vector<int> > sequence { this, "sequence", {0}, description {"The primary sequence to transform."},
         setter { MIN_FUNCTION {
-            if (args.size() == 0 || !only_ints(args))
+            trace_scope traced { "weft.gates sequence" };
+            shared_steps parsed;
+            if (args.size() == 0 || !parse_ints(args, parsed))
                 return this->sequence;
-            else
+            else {
+                m_state.update([&](state& s) { s.sequence = parsed; });
                 return args;
-        }}
+            }
+        }},
+        getter { MIN_GETTER_FUNCTION { return state_steps(m_state, &state::sequence); }}
     };
 
 
     attribute< vector<int> > gates_pattern { this, "gates", {1}, description {"The gates pattern used to transform the primary sequence."},
         setter { MIN_FUNCTION {
-            if (args.size() == 0 || !only_ints(args))
+            trace_scope traced { "weft.gates gates" };
+            shared_steps parsed;
+            if (args.size() == 0 || !parse_ints(args, parsed))
                 return this->gates_pattern;
-            else
+            else {
+                m_state.update([&](state& s) { s.gates = parsed; });
                 return args;
-        }}
+            }
+        }},
+        getter { MIN_GETTER_FUNCTION { return state_steps(m_state, &state::gates); }}
     };
 
 
     message<> bang { this, "bang", "Send out the transformed sequence with repeats applied.",
         MIN_FUNCTION {
-            lock  lock {m_mutex};
+            trace_scope traced { "weft.gates bang" };
+            auto current = m_state.read();
+            bang_stats::scope timing { m_stats, current->sequence->size() };
 
-            atoms transformed_seq;
-            vector<int> seq   = from_atoms<std::vector<int>>(this->sequence);
-            vector<int> gates = from_atoms<std::vector<int>>(this->gates_pattern);
+            if (bang_io(*current, timing))
+                return {};
 
-            for (int i = 0; i < seq.size(); i++)
-                if (gates[i % gates.size()] == 0)
-                    transformed_seq.push_back(0);
-                else
-                    transformed_seq.push_back(seq[i]);
+            const atoms& transformed_seq = current->output.get([&] {
+                const steps& seq   = *current->sequence;
+                const steps& gates = *current->gates;
 
-            lock.unlock();
-            output.send(transformed_seq);
+                step_buffer::use output_use { m_output_seq };
+                steps&           output_seq = *output_use;
+                output_seq.resize(seq.size());
+
+                weft::apply_gates(seq, gates, output_seq);
+
+                atoms computed(output_seq.begin(), output_seq.end());
+                m_stats.record_allocation(computed.size() * sizeof(atom));
+                return computed;
+            });
+
+            timing.output(transformed_seq.size());
+            send_output(output, transformed_seq, output_mode, m_delta);
+            return {};
+        }
+    };
+
+
+    message<> stats { this, "stats", "Send out the object's performance statistics as a dictionary from the rightmost outlet.",
+        MIN_FUNCTION {
+            send_stats(m_stats, stats_output);
+            return {};
+        }
+    };
+
+
+    message<> resetstats { this, "resetstats", "Clear the object's performance statistics.",
+        MIN_FUNCTION {
+            m_stats.reset();
+            return {};
+        }
+    };
+
+
+    message<> setstep { this, "setstep", "Change one step of the sequence, given its index and new value. Only that step of the gated sequence is recomputed.",
+        MIN_FUNCTION {
+            trace_scope traced { "weft.gates setstep" };
+            long    index;
+            int32_t value;
+            if (!parse_edit(args, index, value) || !edit_steps(m_state, &state::sequence, index, value, patch_sequence_edit))
+                cerr << "setstep needs the index of a step in the sequence and its new value" << endl;
+            return {};
+        }
+    };
+
+
+    message<> setpattern { this, "setpattern", "Change one step of the gates pattern, given its index and new value. Only the steps of the gated sequence it lines up with are recomputed.",
+        MIN_FUNCTION {
+            trace_scope traced { "weft.gates setpattern" };
+            long    index;
+            int32_t value;
+            if (!parse_edit(args, index, value) || !edit_steps(m_state, &state::gates, index, value, patch_gates_edit))
+                cerr << "setpattern needs the index of a step in the gates pattern and its new value" << endl;
+            return {};
+        }
+    };
+
+
+    attribute<output_modes> output_mode { this, "output", output_modes::list, output_modes_range,
+        description {"How bang sends out the transformed sequence: as a list, or as delta, a message holding its length and an index and value for each step that changed since the last bang."},
+        setter { MIN_FUNCTION {
+            trace_scope traced { "weft.gates output" };
+            m_delta.reset();
+            return args;
+        }}
+    };
+
+
+    attribute<step_index> cursor { this, "cursor", 0, description {"The index of the step sent out by the next 'next' message."}};
+
+
+    message<> next { this, "next", "Send out the step at the cursor and advance the cursor.",
+        MIN_FUNCTION {
+            send_step(cursor);
+            return {};
+        }
+    };
+
+
+    message<> step { this, "step", "Send out the step at the given index and move the cursor past it.",
+        MIN_FUNCTION {
+            if (args.size() > 0)
+                send_step(step_index(args[0]));
             return {};
         }
     };
 
 
 private:
-    mutex m_mutex;
+    // Length of one sequence of a batch or row of a matrix once transformed.
+    static size_t transformed_length(const state&, size_t seq_size) {
+        return seq_size;
+    }
+
+
+    // One sequence of a batch or row of a matrix, transformed with the state's attributes into
+    // `out`, which holds transformed_length steps.
+    static void transform_into(const state& current, std::span<const int32_t> seq, std::span<int32_t> out) {
+        weft::apply_gates(seq, *current.gates, out);
+    }
+
+
+    // The gated sequence is the same length as the sequence, each step worked out from the
+    // sequence step and the gates pattern step lined up with it. An edit carries the previous output
+    // over, changing only the steps that line up with the edited step.
+    static void patch_sequence_edit(state& previous, const state& next, size_t index) {
+        if (std::unique_ptr<atoms> output = previous.output.take()) {
+            const steps& gates = *next.gates;
+
+            (*output)[index] = weft::gate_step((*next.sequence)[index], gates[index % gates.size()]);
+            next.output.offer(std::move(output));
+        }
+    }
+
+    static void patch_gates_edit(state& previous, const state& next, size_t index) {
+        if (std::unique_ptr<atoms> output = previous.output.take()) {
+            const steps& seq  = *next.sequence;
+            int32_t      gate = (*next.gates)[index];
+
+            for (size_t i = index; i < seq.size(); i += next.gates->size())
+                (*output)[i] = weft::gate_step(seq[i], gate);
+            next.output.offer(std::move(output));
+        }
+    }
+
+    // Compute and send a single step of the transformed sequence without producing the rest of it.
+    void send_step(step_index index) {
+        auto current = m_state.read();
+
+        const auto& stepper = current->stepper.get([&] {
+            return weft::gates_stepper(*current->sequence, *current->gates);
+        });
+
+        int32_t     value;
+        play_result result = play_step(stepper, index, cursor, value);
+        if (result == play_result::too_long)
+            cerr << "the transformed sequence is too long to play step by step" << endl;
+        else if (result == play_result::played)
+            output.send(value);
+    }
 };
 
 
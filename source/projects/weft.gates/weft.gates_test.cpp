@@ -33,6 +33,32 @@ SCENARIO("Object produces correct output") {
             }
         }
 
+        WHEN("it is given a gate pattern of whole-number floats and it is banged") {
+            atoms gates = {1.0, 0.0, 1};
+            my_object.gates_pattern = gates;
+            my_object.bang();
+
+            THEN("the floats are taken as integers") {
+                auto& output = *c74::max::object_getoutput(my_object, 0);
+                atoms expected = {1, 0, 5, 5, 0, 6};
+                REQUIRE(output.size() == 1);
+                REQUIRE(output[0] == expected);
+            }
+        }
+
+        WHEN("it is given a gate pattern with a fractional float and it is banged") {
+            atoms gates = {1, 0.5, 0};
+            my_object.gates_pattern = gates;
+            my_object.bang();
+
+            THEN("the gates are not stored and the original transformation is returned") {
+                auto& output = *c74::max::object_getoutput(my_object, 0);
+                atoms expected = {1, 1, 5, 5, 6, 6};
+                REQUIRE(output.size() == 1);
+                REQUIRE(output[0] == expected);
+            }
+        }
+
         WHEN("it is given a repeater pattern with non-integers and it is banged") {
             atoms gates = {1, 0, 0};
             my_object.gates_pattern = gates;
@@ -75,5 +101,19 @@ SCENARIO("Object produces correct output") {
                 REQUIRE(output[0] == expected);
             }
         }
+
+        WHEN("it is given a gates pattern and is stepped through with 'step'") {
+            atoms gates = {1, 0, 0};
+            my_object.gates_pattern = gates;
+            my_object.step({3});
+            my_object.step({4});
+
+            THEN("each message sends out the single gated step at that index") {
+                auto& output = *c74::max::object_getoutput(my_object, 0);
+                REQUIRE(output.size() == 2);
+                REQUIRE(output[0] == atoms{5});
+                REQUIRE(output[1] == atoms{0});
+            }
+        }
     }
 }
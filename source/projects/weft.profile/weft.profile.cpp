@@ -0,0 +1,78 @@
+/// @file
+///	@ingroup   weft
+///	@copyright Copyright 2020 Stephen Meyer. All rights reserved.
+///	@licence	     Use of this source code is governed by the MIT License found in the License.md file.
+
+#include "c74_min.h"
+#include "../weft.shared/weft.h"
+
+#include <fstream>
+
+using namespace c74::min;
+
+
+class profile : public object<profile> {
+public:
+    MIN_DESCRIPTION {"Trace every weft object in Max and write the trace out for chrome://tracing or Perfetto."};
+    MIN_TAGS        {"sequences, profiling"};
+    MIN_AUTHOR      {"Steve Meyer"};
+    MIN_RELATED     {"weft.rhythm, weft.chain"};
+
+
+    inlet<>  input       { this, "(start, stop, write, clear) control the trace shared by every weft object" };
+    outlet<> info_output { this, "(list) replies, such as the number of events written." };
+
+
+    // The trace is shared by every weft object, so these act on it directly rather than through
+    // an attribute of this object, which would be set again each time another weft.profile is made.
+    message<> start { this, "start", "Start tracing every bang, attribute change and outlet send of every weft object.",
+        MIN_FUNCTION {
+            shared_tracer().enable(true);
+            return {};
+        }
+    };
+
+
+    message<> stop { this, "stop", "Stop tracing, keeping the events traced so far.",
+        MIN_FUNCTION {
+            shared_tracer().enable(false);
+            return {};
+        }
+    };
+
+
+    message<> write { this, "write", "Write the events traced since the last write or clear to a file as trace-event JSON, given as a native absolute path, and send out how many were written.",
+        MIN_FUNCTION {
+            if (args.size() == 0) {
+                cerr << "write needs the path of the file to write" << endl;
+                return {};
+            }
+
+            std::string   path = args[0];
+            std::ofstream file { path };
+            if (!file) {
+                cerr << "could not open " << path << " for writing" << endl;
+                return {};
+            }
+
+            size_t written = shared_tracer().write_json(file);
+            file.close();
+            if (!file)
+                cerr << "could not finish writing " << path << endl;
+
+            info_output.send("write", to_atom_length(written));
+            return {};
+        }
+    };
+
+
+    message<> clear { this, "clear", "Drop the events traced so far. Once tracing has stopped, this also frees the memory they took.",
+        MIN_FUNCTION {
+            shared_tracer().clear();
+            return {};
+        }
+    };
+};
+
+
+MIN_EXTERNAL(profile);
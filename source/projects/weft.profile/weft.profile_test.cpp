@@ -0,0 +1,62 @@
+/// @file
+/// @ingroup   weft
+/// @copyright Copyright 2020 Stephen Meyer. All rights reserved.
+/// @license        Use of this source code is governed by the MIT License found in the License.md file.
+
+#include "c74_min_unittest.h"     // required unit test header
+#include "weft.profile.cpp"    // need the source of our object so that we can access it
+
+#include <filesystem>
+#include <sstream>
+
+
+SCENARIO("object writes a trace") {
+    ext_main(nullptr);    // every unit test must call ext_main() once to configure the class
+
+    GIVEN("An instance of weft.profile") {
+
+        test_wrapper<profile> an_instance;
+        profile&              my_object = an_instance;
+
+        std::string path = (std::filesystem::temp_directory_path() / "weft.profile_test.json").string();
+
+        WHEN("it traces a scope and writes the trace out") {
+            { trace_scope traced { "before start" }; }
+            my_object.start();
+            { trace_scope traced { "traced" }; }
+            my_object.stop();
+            { trace_scope traced { "after stop" }; }
+            my_object.write({ path });
+
+            std::ifstream     file { path };
+            std::stringstream contents;
+            contents << file.rdbuf();
+
+            THEN("it writes the begin and end of the scope traced while it was started") {
+                auto& info = *c74::max::object_getoutput(my_object, 0);
+                atoms expected = {"write", 2};
+                REQUIRE(info.size() == 1);
+                REQUIRE(info[0] == expected);
+
+                REQUIRE(contents.str().rfind("{\"traceEvents\":[", 0) == 0);
+                REQUIRE(contents.str().find("\"name\":\"traced\",\"cat\":\"weft\",\"ph\":\"B\"") != std::string::npos);
+                REQUIRE(contents.str().find("\"name\":\"traced\",\"cat\":\"weft\",\"ph\":\"E\"") != std::string::npos);
+                REQUIRE(contents.str().find("before start") == std::string::npos);
+                REQUIRE(contents.str().find("after stop") == std::string::npos);
+            }
+
+            AND_WHEN("it writes again") {
+                my_object.write({ path });
+
+                THEN("the events already written are not written again") {
+                    auto& info = *c74::max::object_getoutput(my_object, 0);
+                    atoms expected = {"write", 0};
+                    REQUIRE(info.size() == 2);
+                    REQUIRE(info[1] == expected);
+                }
+            }
+        }
+
+        std::filesystem::remove(path);
+    }
+}
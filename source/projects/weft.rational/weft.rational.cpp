@@ -9,7 +9,7 @@
 using namespace c74::min;
 
 
-class rational : public object<rational> {
+class rational : public sequence_object<rational> {
 public:
     MIN_DESCRIPTION {"Transform a sequence by rational melody algorithms."};
     MIN_TAGS        {"sequences, transformations"};
@@ -17,235 +17,398 @@ public:
     MIN_RELATED     {"zl"};
 
 
-    inlet<>  input  { this, "(bang) send out transformed sequence" };
-    outlet<> output { this, "(list) the transformed sequence as a list." };
+    inlet<>       input        { this, "(bang) send out transformed sequence" };
+    traced_outlet output       { this, "weft.rational output", "(list) the transformed sequence as a list." };
+    traced_outlet info_output  { this, "weft.rational info_output", "(list) the length of the melody, in reply to getlength or length." };
+    traced_outlet stats_output { this, "weft.rational stats_output", "(dictionary) performance statistics, in reply to stats." };
 
 
+private:
+    friend class sequence_object<rational>;
+
+    static constexpr const char* class_name = "weft.rational";
+
+    // Everything the melody depends on, published as a whole whenever an attribute changes so
+    // that bang never waits on a setter. The melody and its stepper are computed at most once per
+    // state.
+    struct state {
+        shared_steps    sequence   { make_steps({0}) };
+        weft::melody    melody     { weft::melody::xi };
+        weft::xv_shape  shape;
+        unsigned        threads    { 1 };
+        size_t          max_output { to_output_limit(default_max_output) };
+        overflow_action overflow   { overflow_action::refuse };
+
+        lazy<atoms>                output;
+        lazy<weft::melody_stepper> stepper;
+    };
+
+    snapshot<state> m_state { state {} };
+
+    // Counters for the stats message, recorded by bang.
+    bang_stats m_stats;
+
+    // The output last sent, for @output delta.
+    output_delta m_delta;
+
+    // Where edited sequence steps land in the output, kept between edits.
+    edit_positions m_edit_positions;
+
+    // The steps bang generates before they become atoms.
+    step_buffer m_output_seq;
+
+
+public:
     enum class melodies : int { iv, xi, xv, xvi, enum_count };
 
     enum_map melodies_range = {"iv", "xi", "xv", "xvi"};
 
     attribute<melodies> melody {this, "melody", melodies::xi, melodies_range,
-        description {"The rational melody number (in lowercase roman numerals)."}
+        description {"The rational melody number (in lowercase roman numerals)."},
+        setter { MIN_FUNCTION {
+            trace_scope traced { "weft.rational melody" };
+            if (args.size() > 0)
+                m_state.update([&](state& s) { s.melody = to_melody(args[0]); });
+            return args;
+        }}
+    };
+
+
+    attribute<int> period { this, "period", 63, description {"The number of steps in melody XV."},
+        setter { MIN_FUNCTION {
+            trace_scope traced { "weft.rational period" };
+            if (args.size() == 0 || int(args[0]) < 1)
+                return this->period;
+            else {
+                m_state.update([&](state& s) { s.shape.period = size_t(int(args[0])); });
+                return args;
+            }
+        }}
+    };
+
+
+    attribute<int> base { this, "base", 2, description {"Melody XV is self-similar by powers of this base. Choose a period that shares no factor with it."},
+        setter { MIN_FUNCTION {
+            trace_scope traced { "weft.rational base" };
+            if (args.size() == 0 || int(args[0]) < 1)
+                return this->base;
+            else {
+                m_state.update([&](state& s) { s.shape.base = size_t(int(args[0])); });
+                return args;
+            }
+        }}
+    };
+
+
+    attribute<int> threads { this, "threads", 1,
+        description {"The number of threads used to generate long melodies, or 0 for one per processor core."},
+        setter { MIN_FUNCTION {
+            trace_scope traced { "weft.rational threads" };
+            if (args.size() == 0 || int(args[0]) < 0)
+                return this->threads;
+            else {
+                m_state.update([&](state& s) { s.threads = to_thread_count(int(args[0])); });
+                return args;
+            }
+        }}
     };
 
 
     attribute< vector<int> > sequence { this, "sequence", {0}, description {"The primary sequence to transform."},
         setter { MIN_FUNCTION {
-            if (args.size() == 0 || !only_ints(args))
+            trace_scope traced { "weft.rational sequence" };
+            shared_steps parsed;
+            if (args.size() == 0 || !parse_ints(args, parsed))
                 return this->sequence;
-            else
+            else {
+                m_state.update([&](state& s) { s.sequence = parsed; });
                 return args;
-        }}
+            }
+        }},
+        getter { MIN_GETTER_FUNCTION { return state_steps(m_state, &state::sequence); }}
     };
 
 
     message<> bang { this, "bang", "Send out the transformed sequence with rational melody algorithm applied.",
         MIN_FUNCTION {
-            lock  lock {m_mutex};
-            atoms transformed_seq;
+            trace_scope traced { "weft.rational bang" };
+            auto current = m_state.read();
+            bang_stats::scope timing { m_stats, current->sequence->size() };
 
-            switch(melody) {
-                case melodies::xi: {
-                    melody_xi(transformed_seq);
-                    break;
-                }
-                case melodies::iv: {
-                    melody_iv(transformed_seq);
-                    break;
-                }
-                case melodies::xv: {
-                    melody_xv(transformed_seq);
-                    break;
-                }
-                case melodies::xvi: {
-                    melody_xvi(transformed_seq);
-                    break;
+            if (bang_io(*current, timing))
+                return {};
+
+            size_t length = weft::melody_length(current->melody, current->sequence->size(), current->shape);
+
+            // Even with no max_output, an output too long to count can't be built.
+            if (length == weft::overflowed_length) {
+                cerr << "the melody is too long to compute, so it was not sent" << endl;
+                return {};
+            }
+
+            if (length > current->max_output && current->overflow != overflow_action::truncate) {
+                if (current->overflow == overflow_action::stream) {
+                    timing.output(length);
+                    m_delta.reset();
+                    stream_steps(stepper(*current), current->max_output, output);
                 }
-                case melodies::enum_count:
-                    break;
+                else
+                    cerr << "the melody is longer than max_output, so it was not sent" << endl;
+                return {};
             }
 
-            lock.unlock();
-            output.send(transformed_seq);
+            if (runs_async(async, std::min(length, current->max_output)))
+                m_background.submit([this, pending = timing.defer()] {
+                    auto current = m_state.read();
+                    melody_output(*current);
+                    return async_result<state> { std::move(current), pending };
+                }, cancel);
+            else {
+                const atoms& melody_seq = melody_output(*current);
+                timing.output(melody_seq.size());
+                send_output(output, melody_seq, output_mode, m_delta);
+            }
             return {};
         }
     };
 
 
-private:
-    mutex m_mutex;
-
-    // Logic: go N / 2 + 1 steps forward, N / 2 steps back through a melody
-    // Given the melody: 1 2 3 4 5 6 7 8 9 10 11 12
-    // Generate a sequence that is the concatenation of the following segments:
-    // Segment 1:   1 2 3 4 5 6 7 7 6 5 4 3 2
-    // Segment 2:   2 3 4 5 6 7 8 8 7 6 5 4 3
-    // ...
-    // Segment 11: 11 12 1 2 3 4 5 5 4 3 2 1 12
-    // Segment 12: 12 1 2 3 4 5 6 6 5 4 3 2 1
-    void melody_xi(atoms& transformed_seq) {
-
-        vector<int> seq   = from_atoms<std::vector<int>>(this->sequence);
-        int segment_length = seq.size() / 2 + 1;
-
-        // Do that dance Paula sang about...
-        for (int segment = 0; segment < seq.size(); segment++) {
-
-            // Take two steps forward,
-            for (int index = 0; index < segment_length; index++)
-                transformed_seq.push_back( seq[(index + segment) % seq.size()] );
-
-            // Take one step back.
-            for (int index = 0; index < segment_length - 1; index++)
-                transformed_seq.push_back( transformed_seq[transformed_seq.size() - 1 - index - index] );
+    message<> stats { this, "stats", "Send out the object's performance statistics as a dictionary from the rightmost outlet.",
+        MIN_FUNCTION {
+            send_stats(m_stats, stats_output);
+            return {};
         }
-    }
+    };
 
 
-    // Given: 1 2 3
-    // Generate a sequence that is the concatenation of the following segments:
-    // Segment 1: 1 0 2 0 3 0
-    // Segment 2: 1 2 0 3 1 0 2 3 0
-    // Segment 3: 1 2 3 0 1 2 3 0 1 2 3 0
-    void melody_iv(atoms& transformed_seq) {
+    message<> resetstats { this, "resetstats", "Clear the object's performance statistics.",
+        MIN_FUNCTION {
+            m_stats.reset();
+            return {};
+        }
+    };
 
-        vector<int> seq = from_atoms<std::vector<int>>(this->sequence);
 
-        for (int segment = 1; segment <= seq.size(); segment++) {
+    message<> setstep { this, "setstep", "Change one step of the sequence, given its index and new value. Only the steps of the melody that play it are recomputed.",
+        MIN_FUNCTION {
+            trace_scope traced { "weft.rational setstep" };
+            long    index;
+            int32_t value;
+            if (!parse_edit(args, index, value) || !edit_steps(m_state, &state::sequence, index, value, [this](state& previous, const state& next, size_t step) { patch_sequence_edit(previous, next, step); }))
+                cerr << "setstep needs the index of a step in the sequence and its new value" << endl;
+            return {};
+        }
+    };
 
-            vector<int> rhythm;
-            for (int i = 0; i < segment; i++)
-                rhythm.push_back(1);
-            rhythm.push_back(0);
 
-            int length = seq.size() * (segment + 1);
-            apply_rhythm(transformed_seq, seq, rhythm, length, symbol("wrap"));
-        }
-    }
+    attribute<output_modes> output_mode { this, "output", output_modes::list, output_modes_range,
+        description {"How bang sends out the transformed sequence: as a list, or as delta, a message holding its length and an index and value for each step that changed since the last bang."},
+        setter { MIN_FUNCTION {
+            trace_scope traced { "weft.rational output" };
+            m_delta.reset();
+            return args;
+        }}
+    };
 
 
-    // Given the note series: A G F E D
-    // Generate the self-similar sequence:
-    //
-    // A G G F G E F D
-    // G A E G F F D E
-    // G E A F E D G A
-    // F G F G D A E F
-    // G F E D A G F E
-    // E F D A G G A F
-    // F D G E F A G F
-    // D E A F E F F
-    //
-    // Self-similar by powers of 2. Stepping through the sequence by every note, every 2nd note, every
-    // 4th note, every 8th note will always play the same sequence. Notice in the generated example
-    // above that the first row (every note) and first column (every 8th note) are identical sequences.
-    //
-    // Returns a 63 note sequence.
-    void melody_xv(atoms& transformed_seq) {
-
-        vector<int> seq = from_atoms<std::vector<int>>(this->sequence);
-
-        int seq_steps = 63;
-        int max_power = 7;
-        int rational_melody[63];
-        int count = 0;
-
-        for (int i = 0; i < seq_steps; i++)
-            rational_melody[i] = -1;
-
-        do {
-            // Get the current contiguous range from the beginning of the sequence, defined as
-            // all steps that from the beginning that are not equal to the default value (-1).
-            // This loop does not execute the first time through the do/while loop.
-            int contiguous_end = next_empty_index(rational_melody, seq_steps);
-            for (int i = 0; i < contiguous_end; i++) {
-
-                // Use the contiguous sequence, which represents the steps at every note,
-                // to fill out the pattern at every 2nd, 4th and/or 8th notes.
-                for (int power = 1; power <= max_power; power++) {
-                    int next_step = (int) (i * pow(2.0, power)) % seq_steps;
-                    rational_melody[next_step] = rational_melody[i];
-                }
+    attribute<int> max_output { this, "max_output", default_max_output,
+        description {"The most steps a bang sends out, or 0 for no limit. The overflow attribute sets what happens to a longer melody."},
+        setter { MIN_FUNCTION {
+            trace_scope traced { "weft.rational max_output" };
+            if (args.size() == 0 || int(args[0]) < 0)
+                return this->max_output;
+            else {
+                m_state.update([&](state& s) { s.max_output = to_output_limit(int(args[0])); });
+                return args;
             }
+        }}
+    };
+
+
+    attribute<symbol> overflow { this, "overflow", "refuse",
+        description {"What bang does with a melody longer than max_output: truncate it, stream it out in lists of max_output steps, or refuse to send it."},
+        range {"truncate", "stream", "refuse"},
+        setter { MIN_FUNCTION {
+            trace_scope traced { "weft.rational overflow" };
+            if (args.size() > 0)
+                m_state.update([&](state& s) { s.overflow = to_overflow_action(args[0]); });
+            return args;
+        }}
+    };
+
 
-            // Finally, fill in the earliest empty step with the next note from the notes pattern.
-            // Don't do this if there are no empty sequence steps.
-            int next_empty = next_empty_index(rational_melody, seq_steps);
-            if (next_empty < seq_steps)
-                rational_melody[next_empty] = seq[count % seq.size()];
+    attribute<async_modes> async { this, "async", async_modes::off, async_modes_range,
+        description {"Whether bang computes the melody on a background thread: off, on, or auto for long outputs only. The result is sent out once it is ready."}
+    };
+
+
+    attribute<bool> cancel { this, "cancel", true,
+        description {"With @async, drop any earlier result not yet sent out when the object is banged again."}
+    };
 
-            count++;
 
-        } while (!melody_xv_complete(rational_melody, seq_steps));
+    attribute<step_index> cursor { this, "cursor", 0, description {"The index of the step sent out by the next 'next' message."}};
 
-        for (int step = 0; step < seq_steps; step++)
-            transformed_seq.push_back(rational_melody[step]);
+
+    message<> next { this, "next", "Send out the step at the cursor and advance the cursor.",
+        MIN_FUNCTION {
+            send_step(cursor, true);
+            return {};
+        }
+    };
+
+
+    message<> step { this, "step", "Send out the step at the given index and move the cursor past it.",
+        MIN_FUNCTION {
+            if (args.size() > 0)
+                send_step(step_index(args[0]), true);
+            return {};
+        }
+    };
+
+
+    message<> get { this, "get", "Send out the step of the melody at the given index without moving the cursor.",
+        MIN_FUNCTION {
+            if (args.size() > 0)
+                send_step(step_index(args[0]), false);
+            return {};
+        }
+    };
+
+
+    message<> getlength { this, "getlength", "Send out the length of the melody from the middle outlet without generating it.",
+        MIN_FUNCTION {
+            send_length();
+            return {};
+        }
+    };
+
+
+    message<> length { this, "length", "Send out the length of the melody from the middle outlet. The same as getlength.",
+        MIN_FUNCTION {
+            send_length();
+            return {};
+        }
+    };
+
+
+    ~rational() {
+        m_background.stop();
     }
 
 
-    int next_empty_index(int rational_melody[], int seq_steps) {
-        int step = 0;
-        while (step < seq_steps & rational_melody[step] != -1) { step++; }
-        return step;
+private:
+    // Length of one sequence of a batch or row of a matrix once transformed, cut short at max_output.
+    static size_t transformed_length(const state& current, size_t seq_size) {
+        return std::min(weft::melody_length(current.melody, seq_size, current.shape), current.max_output);
     }
 
 
-    bool melody_xv_complete(int rational_melody[], int seq_steps) {
-        int step = 0;
-        while (step < seq_steps & rational_melody[step] != -1) { step++; }
-        return step >= seq_steps;
+    // One sequence of a batch or row of a matrix, transformed with the state's attributes into
+    // `out`, which holds transformed_length steps.
+    static void transform_into(const state& current, std::span<const int32_t> seq, std::span<int32_t> out) {
+        weft::apply_melody(current.melody, seq, current.shape, out);
     }
 
 
-    void melody_xvi(atoms& transformed_seq) {
+    // An edit to the sequence carries the previous output over, changing only the steps that play
+    // the edited step, when that output was computed whole.
+    void patch_sequence_edit(state& previous, const state& next, size_t index) {
+        const atoms* output = previous.output.computed();
+        if (!output || weft::melody_length(next.melody, next.sequence->size(), next.shape) != output->size())
+            return;
 
-        vector<int> seq = from_atoms<std::vector<int>>(this->sequence);
+        if (auto plan = weft::melody_plan(next.melody, next.sequence->size(), next.shape))
+            patch_output(previous, next, m_edit_positions.of(plan, next.sequence->size(), index), (*next.sequence)[index]);
+    }
 
-        if (seq.size() < 2) {
-            transformed_seq.push_back(seq[0]);
-        } else {
-            atoms seq_indices;
-            atoms first_segment = {0, 1, 0};
-            append_segment(seq_indices, first_segment);
+    // The melody as atoms, computed at most once per state.
+    const atoms& melody_output(const state& current) {
+        return current.output.get([&] {
+            atoms melody_seq = transform(current);
+            m_stats.record_allocation(melody_seq.size() * sizeof(atom));
+            return melody_seq;
+        });
+    }
 
-            atoms prev_segment;
-            append_segment(prev_segment, first_segment);
 
-            for (int i = 2; i < seq.size(); i++) {
-                int prev_segment_idx = 0;
-                atoms next_segment;
-                int next_length = pow(2, i) + 1;
+    // Sends out the results of asynchronous bangs on the scheduler thread.
+    timer<> deliverer { this, MIN_FUNCTION {
+        while (auto result = m_background.take()) {
+            const atoms& melody_seq = melody_output(*result->current);
+            result->timing.output(m_stats, melody_seq.size());
+            send_output(output, melody_seq, output_mode, m_delta);
+        }
+        return {};
+    }};
 
-                for (int j = 0; j < next_length; j++) {
-                    if (j % 2 == 0) {
-                        next_segment.push_back(prev_segment[prev_segment_idx]);
-                        prev_segment_idx++;
-                    } else {
-                        int neighbors[] = { next_segment[j - 1], prev_segment[prev_segment_idx] };
-                        std::sort(neighbors, neighbors + 2);
+    background_worker<async_result<state>> m_background { [this] { deliverer.delay(0); } };
 
-                        if (neighbors[1] - neighbors[0] == 1)
-                            next_segment.push_back(neighbors[1] + 1);
-                        else
-                            next_segment.push_back(neighbors[1] - 1);
-                    }
-                }
 
-                append_segment(seq_indices, next_segment);
-                prev_segment.clear();
-                append_segment(prev_segment, next_segment);
-            }
+    // The melody attribute arrives as its name, or as its index in melodies_range.
+    static weft::melody to_melody(const atom& arg) {
+        static const weft::melody by_index[] = { weft::melody::iv, weft::melody::xi, weft::melody::xv, weft::melody::xvi };
 
-            for (int i = 0; i < seq_indices.size(); i++)
-                transformed_seq.push_back(seq[seq_indices[i]]);
+        if (arg.a_type == c74::max::A_SYM) {
+            symbol name = arg;
+            if (name == symbol("iv"))
+                return weft::melody::iv;
+            else if (name == symbol("xv"))
+                return weft::melody::xv;
+            else if (name == symbol("xvi"))
+                return weft::melody::xvi;
+            else
+                return weft::melody::xi;
         }
+
+        int index = arg;
+        return index >= 0 && index < int(melodies::enum_count) ? by_index[index] : weft::melody::xi;
+    }
+
+    // The melody, cut short at max_output. The plan covers the whole melody, so a truncated
+    // melody is generated directly.
+    atoms transform(const state& current) {
+        const steps& seq    = *current.sequence;
+        size_t       length = weft::melody_length(current.melody, seq.size(), current.shape);
+
+        step_buffer::use output_use { m_output_seq };
+        steps&           output_seq = *output_use;
+        output_seq.resize(std::min(length, current.max_output));
+
+        if (auto plan = output_seq.size() == length ? weft::melody_plan(current.melody, seq.size(), current.shape) : nullptr)
+            weft::parallel_gather(seq, *plan, output_seq, current.threads);
+        else
+            weft::parallel_apply_melody(current.melody, seq, current.shape, output_seq, current.threads);
+        return atoms(output_seq.begin(), output_seq.end());
     }
 
+    static const weft::melody_stepper& stepper(const state& current) {
+        return current.stepper.get([&] {
+            return weft::melody_stepper(*current.sequence, current.melody, current.shape);
+        });
+    }
+
+    void send_length() {
+        auto current = m_state.read();
+
+        info_output.send("length", to_atom_length(weft::melody_length(current->melody, current->sequence->size(), current->shape)));
+    }
 
-    void append_segment(atoms& append_to, atoms& append_from) {
-        for (int i = 0; i < append_from.size(); i++)
-            append_to.push_back(append_from[i]);
+    // Compute and send a single step of the melody without generating the rest of it, moving the
+    // cursor past it when `move_cursor` is set.
+    void send_step(step_index index, bool move_cursor) {
+        auto current = m_state.read();
+
+        step_index  cursor_position = cursor;
+        int32_t     value;
+        play_result result = play_step(stepper(*current), index, cursor_position, value);
+
+        if (move_cursor && result == play_result::played)
+            cursor = cursor_position;
+        if (result == play_result::too_long)
+            cerr << "the melody is too long to play step by step" << endl;
+        else if (result == play_result::played)
+            output.send(value);
     }
 };
 
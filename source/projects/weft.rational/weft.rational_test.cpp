@@ -152,5 +152,168 @@ SCENARIO("Object produces correct output") {
                  }
              }
          }
+
+         WHEN("it is banged, given a new melody number and banged again") {
+             my_object.melody = rational::melodies::xi;
+             my_object.bang();
+             my_object.melody = rational::melodies::iv;
+             my_object.bang();
+
+             THEN("the second transformed sequence uses the new melody") {
+                 auto& output = *c74::max::object_getoutput(my_object, 0);
+                 REQUIRE(output.size() == 2);
+                 REQUIRE(output[0].size() == 20);
+                 REQUIRE(output[1].size() == 56);
+             }
+         }
+
+         WHEN("it is given melody number XVI and queried with 'get' and 'length'") {
+             my_object.melody = rational::melodies::xvi;
+             my_object.get({10});
+             my_object.get({16});
+             my_object.length();
+
+             THEN("the steps at those indices and the melody length are sent out") {
+                 auto& output = *c74::max::object_getoutput(my_object, 0);
+                 REQUIRE(output.size() == 2);
+                 REQUIRE(output[0] == atoms{3});
+                 REQUIRE(output[1] == atoms{1});
+
+                 auto& info = *c74::max::object_getoutput(my_object, 1);
+                 atoms expected = {"length", 17};
+                 REQUIRE(info.size() == 1);
+                 REQUIRE(info[0] == expected);
+             }
+
+             AND_THEN("the cursor is not moved") {
+                 REQUIRE(my_object.cursor == 0);
+             }
+         }
+
+         WHEN("it is given melody number XVI and queried with 'get' past the range of an int") {
+             my_object.melody = rational::melodies::xvi;
+             my_object.get({17LL * 4294967296LL + 10});
+
+             THEN("the index wraps into the melody whole") {
+                 auto& output = *c74::max::object_getoutput(my_object, 0);
+                 REQUIRE(output.size() == 1);
+                 REQUIRE(output[0] == atoms{3});
+             }
+         }
+
+         WHEN("it is given 64 steps with melody number XVI and queried with 'get'") {
+             atoms sequence(64, 1);
+             my_object.sequence = sequence;
+             my_object.melody = rational::melodies::xvi;
+             my_object.get({10});
+
+             THEN("nothing is sent, as the melody is too long to count") {
+                 auto& output = *c74::max::object_getoutput(my_object, 0);
+                 REQUIRE(output.size() == 0);
+             }
+         }
+
+         WHEN("it is given melody number XI and is stepped through with 'next'") {
+             my_object.melody = rational::melodies::xi;
+             for (int i = 0; i < 6; i++)
+                 my_object.next();
+
+             THEN("the melody is sent out one step at a time") {
+                 auto& output = *c74::max::object_getoutput(my_object, 0);
+                 REQUIRE(output.size() == 6);
+                 REQUIRE(output[0] == atoms{1});
+                 REQUIRE(output[1] == atoms{2});
+                 REQUIRE(output[2] == atoms{3});
+                 REQUIRE(output[3] == atoms{3});
+                 REQUIRE(output[4] == atoms{2});
+                 REQUIRE(output[5] == atoms{2});
+             }
+         }
+
+         WHEN("it is given melody number XV with a period and base and it is banged") {
+             atoms sequence = {1, 2, 3};
+             my_object.sequence = sequence;
+             my_object.melody = rational::melodies::xv;
+             my_object.period = 7;
+             my_object.base = 2;
+             my_object.period = 0;
+             my_object.bang();
+
+             THEN("the invalid period is not stored and the melody is self-similar by powers of the base over the period") {
+                 auto& output = *c74::max::object_getoutput(my_object, 0);
+                 atoms expected = { 1, 2, 2, 3, 2, 3, 3 };
+                 REQUIRE(output.size() == 1);
+                 REQUIRE(output[0] == expected);
+             }
+         }
+
+         WHEN("it is given 24 steps with melody number XVI, which makes a melody longer than max_output") {
+             atoms sequence(24, 1);
+             my_object.sequence = sequence;
+             my_object.melody = rational::melodies::xvi;
+             my_object.getlength();
+             my_object.bang();
+
+             THEN("getlength reports the exact length and bang refuses to send the melody") {
+                 auto& output = *c74::max::object_getoutput(my_object, 0);
+                 auto& info   = *c74::max::object_getoutput(my_object, 1);
+                 atoms expected = {"length", 16777237};
+                 REQUIRE(output.size() == 0);
+                 REQUIRE(info.size() == 1);
+                 REQUIRE(info[0] == expected);
+             }
+
+             AND_WHEN("it is set to truncate and banged again") {
+                 my_object.max_output = 5;
+                 my_object.overflow = symbol("truncate");
+                 my_object.bang();
+
+                 THEN("the first max_output steps of the melody are sent") {
+                     auto& output = *c74::max::object_getoutput(my_object, 0);
+                     REQUIRE(output.size() == 1);
+                     REQUIRE(output[0] == atoms {1, 1, 1, 1, 1});
+                 }
+             }
+
+             AND_WHEN("it is set to stream and banged again") {
+                 atoms short_sequence = {1, 2, 3, 4};
+                 my_object.sequence = short_sequence;
+                 my_object.max_output = 4;
+                 my_object.overflow = symbol("stream");
+                 my_object.bang();
+
+                 THEN("the melody is sent in lists of max_output steps") {
+                     auto& output = *c74::max::object_getoutput(my_object, 0);
+                     REQUIRE(output.size() == 5);
+                     REQUIRE(output[0] == atoms {1, 2, 1, 1});
+                     REQUIRE(output[4] == atoms {1});
+                 }
+             }
+         }
+
+         WHEN("it is given 64 steps with melody number XVI and no max_output") {
+             atoms sequence(64, 1);
+             my_object.sequence = sequence;
+             my_object.melody = rational::melodies::xvi;
+             my_object.max_output = 0;
+             my_object.bang();
+
+             THEN("bang refuses to build a melody too long to count") {
+                 auto& output = *c74::max::object_getoutput(my_object, 0);
+                 REQUIRE(output.size() == 0);
+             }
+         }
+
+         WHEN("it is set to go asynchronous automatically and it is banged for a short melody") {
+             my_object.async = async_modes::automatic;
+             my_object.melody = rational::melodies::xi;
+             my_object.bang();
+
+             THEN("the melody is below the threshold and is sent out straight away") {
+                 auto& output = *c74::max::object_getoutput(my_object, 0);
+                 REQUIRE(output.size() == 1);
+                 REQUIRE(output[0].size() == 20);
+             }
+         }
      }
 }
@@ -9,7 +9,7 @@
 using namespace c74::min;
 
 
-class repeater : public object<repeater> {
+class repeater : public sequence_object<repeater> {
 public:
     MIN_DESCRIPTION {"Transform a sequence by applying a repeater sequence."};
     MIN_TAGS        {"sequences, transformations"};
@@ -17,54 +17,320 @@ public:
     MIN_RELATED     {"zl"};
 
 
-    inlet<>  input  { this, "(bang) send out transformed sequence; (list) set the primary sequence." };
-    outlet<> output { this, "(list) the transformed sequence as a list." };
+    inlet<>       input        { this, "(bang) send out transformed sequence; (list) set the primary sequence." };
+    traced_outlet output       { this, "weft.repeater output", "(list) the transformed sequence as a list." };
+    traced_outlet info_output  { this, "weft.repeater info_output", "(list) the length of the transformed sequence, in reply to getlength." };
+    traced_outlet stats_output { this, "weft.repeater stats_output", "(dictionary) performance statistics, in reply to stats." };
 
 
+private:
+    friend class sequence_object<repeater>;
+
+    static constexpr const char* class_name = "weft.repeater";
+
+    // Everything the transform depends on, published as a whole whenever an attribute changes so
+    // that bang never waits on a setter. The transformed sequence and stepper are computed at
+    // most once per state.
+    struct state {
+        shared_steps    sequence   { make_steps({0}) };
+        shared_steps    repeats    { make_steps({1}) };
+        size_t          max_output { to_output_limit(default_max_output) };
+        overflow_action overflow   { overflow_action::refuse };
+
+        lazy<atoms>                 output;
+        lazy<weft::repeats_stepper> stepper;
+    };
+
+    snapshot<state> m_state { state {} };
+
+    // Counters for the stats message, recorded by bang.
+    bang_stats m_stats;
+
+    // The output last sent, for @output delta.
+    output_delta m_delta;
+
+    // Where edited sequence steps land in the output, kept between edits.
+    edit_positions m_edit_positions;
+
+    // The steps bang generates before they become atoms.
+    step_buffer m_output_seq;
+
+
+public:
     attribute< vector<int> > sequence { this, "sequence", {0}, description {"The primary sequence to transform."},
         setter { MIN_FUNCTION {
-            if (args.size() == 0 || !only_ints(args))
+            trace_scope traced { "weft.repeater sequence" };
+            shared_steps parsed;
+            if (args.size() == 0 || !parse_ints(args, parsed))
                 return this->sequence;
-            else
+            else {
+                m_state.update([&](state& s) { s.sequence = parsed; });
                 return args;
-        }}
+            }
+        }},
+        getter { MIN_GETTER_FUNCTION { return state_steps(m_state, &state::sequence); }}
     };
 
 
     attribute< vector<int> > repeats_pattern { this, "repeats", {1}, description {"The repeats pattern used to transform the primary sequence."},
         setter { MIN_FUNCTION {
-            if (args.size() == 0 || !only_ints(args))
+            trace_scope traced { "weft.repeater repeats" };
+            shared_steps parsed;
+            if (args.size() == 0 || !parse_ints(args, parsed))
                 return this->repeats_pattern;
-            else
+            else {
+                m_state.update([&](state& s) { s.repeats = parsed; });
                 return args;
-        }}
+            }
+        }},
+        getter { MIN_GETTER_FUNCTION { return state_steps(m_state, &state::repeats); }}
     };
 
 
     message<> bang { this, "bang", "Send out the transformed sequence with repeats applied.",
         MIN_FUNCTION {
-            lock  lock {m_mutex};
+            trace_scope traced { "weft.repeater bang" };
+            auto current = m_state.read();
+            bang_stats::scope timing { m_stats, current->sequence->size() };
+
+            if (bang_io(*current, timing))
+                return {};
+
+            size_t length = weft::repeats_length(*current->sequence, *current->repeats);
 
-            atoms transformed_seq;
-            vector<int> seq     = from_atoms<std::vector<int>>(this->sequence);
-            vector<int> repeats = from_atoms<std::vector<int>>(this->repeats_pattern);
+            // Even with no max_output, an output too long to count can't be built.
+            if (length == weft::overflowed_length) {
+                cerr << "the transformed sequence is too long to compute, so it was not sent" << endl;
+                return {};
+            }
+
+            if (length > current->max_output && current->overflow != overflow_action::truncate) {
+                if (current->overflow == overflow_action::stream) {
+                    timing.output(length);
+                    m_delta.reset();
+                    stream_steps(stepper(*current), current->max_output, output);
+                }
+                else
+                    cerr << "the transformed sequence is longer than max_output, so it was not sent" << endl;
+                return {};
+            }
 
-            for (int i = 0; i < seq.size(); i++) {
-                atom current_step = seq[i];
-                int repeat_step   = repeats[i % repeats.size()];
-                for (int j = 0; j < repeat_step; j++)
-                    transformed_seq.push_back(current_step);
+            if (runs_async(async, std::min(length, current->max_output)))
+                m_background.submit([this, pending = timing.defer()] {
+                    auto current = m_state.read();
+                    transform(*current);
+                    return async_result<state> { std::move(current), pending };
+                }, cancel);
+            else {
+                const atoms& transformed_seq = transform(*current);
+                timing.output(transformed_seq.size());
+                send_output(output, transformed_seq, output_mode, m_delta);
             }
+            return {};
+        }
+    };
+
 
-            lock.unlock();
-            output.send(transformed_seq);
+    message<> stats { this, "stats", "Send out the object's performance statistics as a dictionary from the rightmost outlet.",
+        MIN_FUNCTION {
+            send_stats(m_stats, stats_output);
+            return {};
+        }
+    };
+
+
+    message<> resetstats { this, "resetstats", "Clear the object's performance statistics.",
+        MIN_FUNCTION {
+            m_stats.reset();
+            return {};
+        }
+    };
+
+
+    message<> getlength { this, "getlength", "Send out the length of the transformed sequence from the middle outlet without computing it.",
+        MIN_FUNCTION {
+            auto current = m_state.read();
+
+            info_output.send("length", to_atom_length(weft::repeats_length(*current->sequence, *current->repeats)));
             return {};
         }
     };
 
 
+    message<> setstep { this, "setstep", "Change one step of the sequence, given its index and new value. Only the steps of the transformed sequence that repeat it are recomputed.",
+        MIN_FUNCTION {
+            trace_scope traced { "weft.repeater setstep" };
+            long    index;
+            int32_t value;
+            if (!parse_edit(args, index, value) || !edit_steps(m_state, &state::sequence, index, value, [this](state& previous, const state& next, size_t step) { patch_sequence_edit(previous, next, step); }))
+                cerr << "setstep needs the index of a step in the sequence and its new value" << endl;
+            return {};
+        }
+    };
+
+
+    message<> setpattern { this, "setpattern", "Change one step of the repeats pattern, given its index and new value.",
+        MIN_FUNCTION {
+            trace_scope traced { "weft.repeater setpattern" };
+            long    index;
+            int32_t value;
+            if (!parse_edit(args, index, value) || !edit_steps(m_state, &state::repeats, index, value, [](state&, const state&, size_t) {}))
+                cerr << "setpattern needs the index of a step in the repeats pattern and its new value" << endl;
+            return {};
+        }
+    };
+
+
+    attribute<output_modes> output_mode { this, "output", output_modes::list, output_modes_range,
+        description {"How bang sends out the transformed sequence: as a list, or as delta, a message holding its length and an index and value for each step that changed since the last bang."},
+        setter { MIN_FUNCTION {
+            trace_scope traced { "weft.repeater output" };
+            m_delta.reset();
+            return args;
+        }}
+    };
+
+
+    attribute<int> max_output { this, "max_output", default_max_output,
+        description {"The most steps a bang sends out, or 0 for no limit. The overflow attribute sets what happens to a longer output."},
+        setter { MIN_FUNCTION {
+            trace_scope traced { "weft.repeater max_output" };
+            if (args.size() == 0 || int(args[0]) < 0)
+                return this->max_output;
+            else {
+                m_state.update([&](state& s) { s.max_output = to_output_limit(int(args[0])); });
+                return args;
+            }
+        }}
+    };
+
+
+    attribute<symbol> overflow { this, "overflow", "refuse",
+        description {"What bang does with an output longer than max_output: truncate it, stream it out in lists of max_output steps, or refuse to send it."},
+        range {"truncate", "stream", "refuse"},
+        setter { MIN_FUNCTION {
+            trace_scope traced { "weft.repeater overflow" };
+            if (args.size() > 0)
+                m_state.update([&](state& s) { s.overflow = to_overflow_action(args[0]); });
+            return args;
+        }}
+    };
+
+
+    attribute<async_modes> async { this, "async", async_modes::off, async_modes_range,
+        description {"Whether bang computes the transformed sequence on a background thread: off, on, or auto for long outputs only. The result is sent out once it is ready."}
+    };
+
+
+    attribute<bool> cancel { this, "cancel", true,
+        description {"With @async, drop any earlier result not yet sent out when the object is banged again."}
+    };
+
+
+    attribute<step_index> cursor { this, "cursor", 0, description {"The index of the step sent out by the next 'next' message."}};
+
+
+    message<> next { this, "next", "Send out the step at the cursor and advance the cursor.",
+        MIN_FUNCTION {
+            send_step(cursor);
+            return {};
+        }
+    };
+
+
+    message<> step { this, "step", "Send out the step at the given index and move the cursor past it.",
+        MIN_FUNCTION {
+            if (args.size() > 0)
+                send_step(step_index(args[0]));
+            return {};
+        }
+    };
+
+
+    ~repeater() {
+        m_background.stop();
+    }
+
+
 private:
-    mutex m_mutex;
+    // Length of one sequence of a batch or row of a matrix once transformed, cut short at max_output.
+    static size_t transformed_length(const state& current, size_t seq_size) {
+        return std::min(weft::repeats_length(seq_size, *current.repeats), current.max_output);
+    }
+
+
+    // One sequence of a batch or row of a matrix, transformed with the state's attributes into
+    // `out`, which holds transformed_length steps.
+    static void transform_into(const state& current, std::span<const int32_t> seq, std::span<int32_t> out) {
+        weft::apply_repeats(seq, *current.repeats, out);
+    }
+
+
+    // An edit to the sequence carries the previous output over, changing only the steps that play
+    // the edited step, when that output was computed whole.
+    void patch_sequence_edit(state& previous, const state& next, size_t index) {
+        const atoms* output = previous.output.computed();
+        if (!output || weft::repeats_length(*next.sequence, *next.repeats) != output->size())
+            return;
+
+        if (auto plan = weft::repeats_plan(next.sequence->size(), *next.repeats))
+            patch_output(previous, next, m_edit_positions.of(plan, next.sequence->size(), index), (*next.sequence)[index]);
+    }
+
+    // The transformed sequence, cut short at max_output, computed at most once per state.
+    const atoms& transform(const state& current) {
+        return current.output.get([&] {
+            const steps& seq     = *current.sequence;
+            const steps& repeats = *current.repeats;
+            size_t       length  = weft::repeats_length(seq, repeats);
+
+            step_buffer::use output_use { m_output_seq };
+            steps&           output_seq = *output_use;
+            output_seq.resize(std::min(length, current.max_output));
+
+            // The plan covers the whole output, so a truncated output is generated directly.
+            if (auto plan = output_seq.size() == length ? weft::repeats_plan(seq.size(), repeats) : nullptr)
+                weft::gather(seq, *plan, output_seq);
+            else
+                weft::apply_repeats(seq, repeats, output_seq);
+
+            atoms transformed_seq(output_seq.begin(), output_seq.end());
+            m_stats.record_allocation(transformed_seq.size() * sizeof(atom));
+            return transformed_seq;
+        });
+    }
+
+
+    // Sends out the results of asynchronous bangs on the scheduler thread.
+    timer<> deliverer { this, MIN_FUNCTION {
+        while (auto result = m_background.take()) {
+            const atoms& transformed_seq = transform(*result->current);
+            result->timing.output(m_stats, transformed_seq.size());
+            send_output(output, transformed_seq, output_mode, m_delta);
+        }
+        return {};
+    }};
+
+    background_worker<async_result<state>> m_background { [this] { deliverer.delay(0); } };
+
+
+    static const weft::repeats_stepper& stepper(const state& current) {
+        return current.stepper.get([&] {
+            return weft::repeats_stepper(*current.sequence, *current.repeats);
+        });
+    }
+
+    // Compute and send a single step of the transformed sequence without producing the rest of it.
+    void send_step(step_index index) {
+        auto current = m_state.read();
+
+        int32_t     value;
+        play_result result = play_step(stepper(*current), index, cursor, value);
+        if (result == play_result::too_long)
+            cerr << "the transformed sequence is too long to play step by step" << endl;
+        else if (result == play_result::played)
+            output.send(value);
+    }
 };
 
 
@@ -86,5 +86,46 @@ SCENARIO("Object produces correct output") {
                 REQUIRE(output[0] == expected);
             }
         }
+
+        WHEN("it is given a repeats pattern and is stepped through with 'step'") {
+            atoms repeats = {3, 2, 1};
+            my_object.repeats_pattern = repeats;
+            my_object.step({2});
+            my_object.step({3});
+            my_object.step({5});
+            my_object.next();
+
+            THEN("each message sends out the single repeated step at that index") {
+                auto& output = *c74::max::object_getoutput(my_object, 0);
+                REQUIRE(output.size() == 4);
+                REQUIRE(output[0] == atoms{1});
+                REQUIRE(output[1] == atoms{5});
+                REQUIRE(output[2] == atoms{6});
+                REQUIRE(output[3] == atoms{4});
+            }
+        }
+    }
+
+        WHEN("a second instance with the same shape but different steps is banged") {
+            atoms repeats = {2, 1};
+            my_object.repeats_pattern = repeats;
+            my_object.bang();
+
+            test_wrapper<repeater> other_instance;
+            repeater&             other_object = other_instance;
+            atoms other_sequence = {7, 8, 9, 3};
+            other_object.sequence = other_sequence;
+            other_object.repeats_pattern = repeats;
+            other_object.bang();
+
+            THEN("each instance repeats its own steps") {
+                auto& output = *c74::max::object_getoutput(my_object, 0);
+                auto& other_output = *c74::max::object_getoutput(other_object, 0);
+                REQUIRE(output.size() == 1);
+                REQUIRE(output[0] == atoms{1, 1, 5, 6, 6, 4});
+                REQUIRE(other_output.size() == 1);
+                REQUIRE(other_output[0] == atoms{7, 7, 8, 9, 9, 3});
+            }
+        }
     }
 }
@@ -0,0 +1,106 @@
+/// @file
+///	@ingroup   weft
+///	@copyright Copyright 2020 Stephen Meyer. All rights reserved.
+///	@licence	     Use of this source code is governed by the MIT License found in the License.md file.
+
+#include "c74_min.h"
+#include "../weft.shared/weft.h"
+
+using namespace c74::min;
+
+
+class repeater_tilde : public object<repeater_tilde>, public vector_operator<> {
+public:
+    MIN_DESCRIPTION {"Play a sequence with a repeats pattern applied, at signal rate."};
+    MIN_TAGS        {"sequences, transformations, audio"};
+    MIN_AUTHOR      {"Steve Meyer"};
+    MIN_RELATED     {"weft.repeater, weft.rhythm~, phasor~"};
+
+
+    inlet<>  input  { this, "(signal) the step index to play, or a phasor with @input phasor." };
+    outlet<> output { this, "(signal) the step of the transformed sequence at the input.", "signal" };
+
+
+private:
+    // Everything the transform depends on, published as a whole whenever an attribute changes.
+    // The stepper is built by the setter so that the audio thread never allocates.
+    struct state {
+        shared_steps        sequence { make_steps({0}) };
+        shared_steps        repeats  { make_steps({1}) };
+        signal_input        input    { signal_input::index };
+
+        std::shared_ptr<const weft::repeats_stepper> stepper { build_stepper() };
+
+        std::shared_ptr<const weft::repeats_stepper> build_stepper() const {
+            return std::make_shared<const weft::repeats_stepper>(*sequence, *repeats);
+        }
+    };
+
+    snapshot<state> m_state { state {} };
+
+
+public:
+    attribute<symbol> input_mode { this, "input", "index",
+        description {"How the input signal is read: as a step index, or as a phasor that plays the whole transformed sequence once per cycle."},
+        range {"index", "phasor"},
+        setter { MIN_FUNCTION {
+            trace_scope traced { "weft.repeater~ input" };
+            if (args.size() > 0)
+                m_state.update([&](state& s) { s.input = to_signal_input(args[0]); });
+            return args;
+        }}
+    };
+
+
+    attribute< vector<int> > sequence { this, "sequence", {0}, description {"The primary sequence to transform."},
+        setter { MIN_FUNCTION {
+            trace_scope traced { "weft.repeater~ sequence" };
+            shared_steps parsed;
+            if (args.size() == 0 || !parse_ints(args, parsed))
+                return this->sequence;
+            else {
+                update([&](state& s) { s.sequence = parsed; });
+                return args;
+            }
+        }}
+    };
+
+
+    attribute< vector<int> > repeats_pattern { this, "repeats", {1}, description {"The repeats pattern used to transform the primary sequence."},
+        setter { MIN_FUNCTION {
+            trace_scope traced { "weft.repeater~ repeats" };
+            shared_steps parsed;
+            if (args.size() == 0 || !parse_ints(args, parsed))
+                return this->repeats_pattern;
+            else {
+                update([&](state& s) { s.repeats = parsed; });
+                return args;
+            }
+        }}
+    };
+
+
+    void operator()(audio_bundle input, audio_bundle output) {
+        auto current = m_state.read();
+
+        auto in  = input.samples(0);
+        auto out = output.samples(0);
+
+        for (auto i = 0; i < input.frame_count(); ++i)
+            out[i] = signal_step(*current->stepper, in[i], current->input);
+    }
+
+
+private:
+    // Publish a change to the state, rebuilding its stepper.
+    template<class change_function>
+    void update(change_function change) {
+        m_state.update([&](state& s) {
+            change(s);
+            s.stepper = s.build_stepper();
+        });
+    }
+};
+
+
+MIN_EXTERNAL(repeater_tilde);
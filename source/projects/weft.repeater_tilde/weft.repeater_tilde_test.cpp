@@ -0,0 +1,56 @@
+/// @file
+/// @ingroup   weft
+/// @copyright Copyright 2020 Stephen Meyer. All rights reserved.
+/// @license        Use of this source code is governed by the MIT License found in the License.md file.
+
+#include "c74_min_unittest.h"        // required unit test header
+#include "weft.repeater_tilde.cpp"   // need the source of our object so that we can access it
+
+
+SCENARIO("Object produces correct output") {
+    ext_main(nullptr);    // every unit test must call ext_main() once to configure the class
+
+    GIVEN("An instance of weft.repeater~ with a sequence and a repeats pattern") {
+
+        test_wrapper<repeater_tilde> an_instance;
+        repeater_tilde&             my_object = an_instance;
+        atoms sequence = {1, 5, 6, 4};
+        atoms repeats  = {3, 2, 1};
+        my_object.sequence = sequence;
+        my_object.repeats_pattern = repeats;
+
+        WHEN("it is given a signal of step indices") {
+            sample  input_samples[]   = {0, 3, 5, 6, 9, -1};
+            sample  output_samples[6] = {};
+            sample* input_channels[]  = {input_samples};
+            sample* output_channels[] = {output_samples};
+
+            my_object(audio_bundle(input_channels, 1, 6), audio_bundle(output_channels, 1, 6));
+
+            THEN("it outputs the repeated step at each index, wrapping around the transformed sequence") {
+                REQUIRE(output_samples[0] == 1);
+                REQUIRE(output_samples[1] == 5);
+                REQUIRE(output_samples[2] == 6);
+                REQUIRE(output_samples[3] == 4);
+                REQUIRE(output_samples[4] == 1);
+                REQUIRE(output_samples[5] == 4);
+            }
+        }
+
+        WHEN("it is given a phasor") {
+            my_object.input_mode = symbol("phasor");
+
+            sample  input_samples[]   = {0.0, 0.5};
+            sample  output_samples[2] = {};
+            sample* input_channels[]  = {input_samples};
+            sample* output_channels[] = {output_samples};
+
+            my_object(audio_bundle(input_channels, 1, 2), audio_bundle(output_channels, 1, 2));
+
+            THEN("each cycle of the phasor plays the whole transformed sequence") {
+                REQUIRE(output_samples[0] == 1);
+                REQUIRE(output_samples[1] == 5);
+            }
+        }
+    }
+}
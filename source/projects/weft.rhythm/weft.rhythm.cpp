@@ -9,7 +9,7 @@
 using namespace c74::min;
 
 
-class rhythm : public object<rhythm> {
+class rhythm : public sequence_object<rhythm> {
 public:
     MIN_DESCRIPTION {"Transform a sequence by applying a rhythmic pattern."};
     MIN_TAGS        {"sequences, transformations"};
@@ -17,71 +17,363 @@ public:
     MIN_RELATED     {"zl"};
 
 
-    inlet<>  input  { this, "(bang) send out transformed sequence" };
-    outlet<> output { this, "(list) the transformed sequence as a list." };
+    inlet<>       input        { this, "(bang) send out transformed sequence" };
+    traced_outlet output       { this, "weft.rhythm output", "(list) the transformed sequence as a list." };
+    traced_outlet info_output  { this, "weft.rhythm info_output", "(list) the length of the transformed sequence, in reply to getlength." };
+    traced_outlet stats_output { this, "weft.rhythm stats_output", "(dictionary) performance statistics, in reply to stats." };
 
 
-    attribute<int> length { this, "length", -1, description {"The length of the transformed sequence in steps."}};
+private:
+    friend class sequence_object<rhythm>;
+
+    static constexpr const char* class_name = "weft.rhythm";
+
+    // Everything the transform depends on, published as a whole whenever an attribute changes so
+    // that bang never waits on a setter. The transformed sequence and stepper are computed at
+    // most once per state.
+    struct state {
+        shared_steps    sequence   { make_steps({0}) };
+        shared_steps    rhythm     { make_steps({1}) };
+        int             length     { -1 };
+        weft::fill_mode mode       { weft::fill_mode::wrap };
+        unsigned        threads    { 1 };
+        size_t          max_output { to_output_limit(default_max_output) };
+        overflow_action overflow   { overflow_action::refuse };
+
+        lazy<atoms>                output;
+        lazy<weft::rhythm_stepper> stepper;
+    };
+
+    snapshot<state> m_state { state {} };
+
+    // Counters for the stats message, recorded by bang.
+    bang_stats m_stats;
+
+    // The output last sent, for @output delta.
+    output_delta m_delta;
+
+    // Where edited sequence steps land in the output, kept between edits.
+    edit_positions m_edit_positions;
+
+    // The steps bang generates before they become atoms.
+    step_buffer m_output_seq;
+
+
+public:
+    attribute<int> length { this, "length", -1, description {"The length of the transformed sequence in steps."},
+        setter { MIN_FUNCTION {
+            trace_scope traced { "weft.rhythm length" };
+            if (args.size() > 0)
+                m_state.update([&](state& s) { s.length = int(args[0]); });
+            return args;
+        }}
+    };
     attribute<symbol> fill_mode { this, "fill_mode", "wrap",
         description {"The mode used to fill out a sequence when the length is longer than the transformed sequence."},
-        range {"wrap", "silence"}
+        range {"wrap", "silence"},
+        setter { MIN_FUNCTION {
+            trace_scope traced { "weft.rhythm fill_mode" };
+            if (args.size() > 0)
+                m_state.update([&](state& s) { s.mode = to_fill_mode(args[0]); });
+            return args;
+        }}
+    };
+
+
+    attribute<int> threads { this, "threads", 1,
+        description {"The number of threads used to generate long sequences, or 0 for one per processor core."},
+        setter { MIN_FUNCTION {
+            trace_scope traced { "weft.rhythm threads" };
+            if (args.size() == 0 || int(args[0]) < 0)
+                return this->threads;
+            else {
+                m_state.update([&](state& s) { s.threads = to_thread_count(int(args[0])); });
+                return args;
+            }
+        }}
     };
 
 
     attribute< vector<int> > sequence { this, "sequence", {0}, description {"The primary sequence to transform."},
         setter { MIN_FUNCTION {
-            if (args.size() == 0 || !only_ints(args))
+            trace_scope traced { "weft.rhythm sequence" };
+            shared_steps parsed;
+            if (args.size() == 0 || !parse_ints(args, parsed))
                 return this->sequence;
-            else
+            else {
+                m_state.update([&](state& s) { s.sequence = parsed; });
                 return args;
-        }}
+            }
+        }},
+        getter { MIN_GETTER_FUNCTION { return state_steps(m_state, &state::sequence); }}
     };
 
 
     attribute< vector<int> > rhythm_pattern { this, "rhythm", {1}, description {"The rhythm pattern used to transform the primary sequence."},
         setter { MIN_FUNCTION {
-            if (args.size() == 0 || !only_ints(args))
+            trace_scope traced { "weft.rhythm rhythm" };
+            shared_steps parsed;
+            if (args.size() == 0 || !parse_ints(args, parsed))
                 return this->rhythm_pattern;
-            else
+            else {
+                m_state.update([&](state& s) { s.rhythm = parsed; });
                 return args;
-        }}
+            }
+        }},
+        getter { MIN_GETTER_FUNCTION { return state_steps(m_state, &state::rhythm); }}
     };
 
 
     message<> bang { this, "bang", "Send out the transformed sequence with rhythm applied.",
         MIN_FUNCTION {
-            lock  lock {m_mutex};
+            trace_scope traced { "weft.rhythm bang" };
+            auto current = m_state.read();
+            bang_stats::scope timing { m_stats, current->sequence->size() };
 
-            atoms transformed_seq;
-            vector<int> seq   = from_atoms<std::vector<int>>(this->sequence);
-            vector<int> rhythm = from_atoms<std::vector<int>>(this->rhythm_pattern);
+            if (bang_io(*current, timing))
+                return {};
 
-            apply_rhythm(transformed_seq, seq, rhythm, this->length, this->fill_mode);
+            size_t length = weft::rhythm_length(*current->sequence, *current->rhythm, current->length);
 
-            lock.unlock();
-            output.send(transformed_seq);
+            // Even with no max_output, an output too long to count can't be built.
+            if (length == weft::overflowed_length) {
+                cerr << "the transformed sequence is too long to compute, so it was not sent" << endl;
+                return {};
+            }
+
+            if (length > current->max_output && current->overflow != overflow_action::truncate) {
+                if (current->overflow == overflow_action::stream) {
+                    timing.output(length);
+                    m_delta.reset();
+                    stream_steps(stepper(*current), current->max_output, output);
+                }
+                else
+                    cerr << "the transformed sequence is longer than max_output, so it was not sent" << endl;
+                return {};
+            }
+
+            if (runs_async(async, std::min(length, current->max_output)))
+                m_background.submit([this, pending = timing.defer()] {
+                    auto current = m_state.read();
+                    transform(*current);
+                    return async_result<state> { std::move(current), pending };
+                }, cancel);
+            else {
+                const atoms& transformed_seq = transform(*current);
+                timing.output(transformed_seq.size());
+                send_output(output, transformed_seq, output_mode, m_delta);
+            }
             return {};
         }
     };
 
 
-private:
-    mutex m_mutex;
-
-    int calculate_length(vector<int> const &seq, vector<int> const &rhythm) {
-        int rhythm_hits = 0;
-        float seq_length = seq.size();
-        for (int i = 0; i < rhythm.size(); i++) {
-            if (rhythm[i] != 0)
-                rhythm_hits++;
+    message<> stats { this, "stats", "Send out the object's performance statistics as a dictionary from the rightmost outlet.",
+        MIN_FUNCTION {
+            send_stats(m_stats, stats_output);
+            return {};
+        }
+    };
+
+
+    message<> resetstats { this, "resetstats", "Clear the object's performance statistics.",
+        MIN_FUNCTION {
+            m_stats.reset();
+            return {};
+        }
+    };
+
+
+    message<> getlength { this, "getlength", "Send out the length of the transformed sequence from the middle outlet without computing it.",
+        MIN_FUNCTION {
+            auto current = m_state.read();
+
+            info_output.send("length", to_atom_length(weft::rhythm_length(*current->sequence, *current->rhythm, current->length)));
+            return {};
+        }
+    };
+
+
+    message<> setstep { this, "setstep", "Change one step of the sequence, given its index and new value. Only the steps of the transformed sequence that play it are recomputed.",
+        MIN_FUNCTION {
+            trace_scope traced { "weft.rhythm setstep" };
+            long    index;
+            int32_t value;
+            if (!parse_edit(args, index, value) || !edit_steps(m_state, &state::sequence, index, value, [this](state& previous, const state& next, size_t step) { patch_sequence_edit(previous, next, step); }))
+                cerr << "setstep needs the index of a step in the sequence and its new value" << endl;
+            return {};
+        }
+    };
+
+
+    message<> setpattern { this, "setpattern", "Change one step of the rhythm, given its index and new value. The transformed sequence is kept if the step is still a hit, or still a rest.",
+        MIN_FUNCTION {
+            trace_scope traced { "weft.rhythm setpattern" };
+            long    index;
+            int32_t value;
+            if (!parse_edit(args, index, value) || !edit_steps(m_state, &state::rhythm, index, value, patch_rhythm_edit))
+                cerr << "setpattern needs the index of a step in the rhythm and its new value" << endl;
+            return {};
+        }
+    };
+
+
+    attribute<output_modes> output_mode { this, "output", output_modes::list, output_modes_range,
+        description {"How bang sends out the transformed sequence: as a list, or as delta, a message holding its length and an index and value for each step that changed since the last bang."},
+        setter { MIN_FUNCTION {
+            trace_scope traced { "weft.rhythm output" };
+            m_delta.reset();
+            return args;
+        }}
+    };
+
+
+    attribute<int> max_output { this, "max_output", default_max_output,
+        description {"The most steps a bang sends out, or 0 for no limit. The overflow attribute sets what happens to a longer output."},
+        setter { MIN_FUNCTION {
+            trace_scope traced { "weft.rhythm max_output" };
+            if (args.size() == 0 || int(args[0]) < 0)
+                return this->max_output;
+            else {
+                m_state.update([&](state& s) { s.max_output = to_output_limit(int(args[0])); });
+                return args;
+            }
+        }}
+    };
+
+
+    attribute<symbol> overflow { this, "overflow", "refuse",
+        description {"What bang does with an output longer than max_output: truncate it, stream it out in lists of max_output steps, or refuse to send it."},
+        range {"truncate", "stream", "refuse"},
+        setter { MIN_FUNCTION {
+            trace_scope traced { "weft.rhythm overflow" };
+            if (args.size() > 0)
+                m_state.update([&](state& s) { s.overflow = to_overflow_action(args[0]); });
+            return args;
+        }}
+    };
+
+
+    attribute<async_modes> async { this, "async", async_modes::off, async_modes_range,
+        description {"Whether bang computes the transformed sequence on a background thread: off, on, or auto for long outputs only. The result is sent out once it is ready."}
+    };
+
+
+    attribute<bool> cancel { this, "cancel", true,
+        description {"With @async, drop any earlier result not yet sent out when the object is banged again."}
+    };
+
+
+    attribute<step_index> cursor { this, "cursor", 0, description {"The index of the step sent out by the next 'next' message."}};
+
+
+    message<> next { this, "next", "Send out the step at the cursor and advance the cursor.",
+        MIN_FUNCTION {
+            send_step(cursor);
+            return {};
+        }
+    };
+
+
+    message<> step { this, "step", "Send out the step at the given index and move the cursor past it.",
+        MIN_FUNCTION {
+            if (args.size() > 0)
+                send_step(step_index(args[0]));
+            return {};
         }
+    };
+
+
+    ~rhythm() {
+        m_background.stop();
+    }
+
+
+private:
+    // Length of one sequence of a batch or row of a matrix once transformed, cut short at max_output.
+    static size_t transformed_length(const state& current, size_t seq_size) {
+        return std::min(weft::rhythm_length(seq_size, *current.rhythm, current.length), current.max_output);
+    }
+
+
+    // One sequence of a batch or row of a matrix, transformed with the state's attributes into
+    // `out`, which holds transformed_length steps.
+    static void transform_into(const state& current, std::span<const int32_t> seq, std::span<int32_t> out) {
+        weft::apply_rhythm(seq, *current.rhythm, current.mode, out);
+    }
+
+
+    // An edit to the sequence carries the previous output over, changing only the steps that play
+    // the edited step, when that output was computed whole.
+    void patch_sequence_edit(state& previous, const state& next, size_t index) {
+        const atoms* output = previous.output.computed();
+        if (!output || weft::rhythm_length(*next.sequence, *next.rhythm, next.length) != output->size())
+            return;
+
+        if (auto plan = weft::rhythm_plan(next.sequence->size(), *next.rhythm, next.mode, next.length))
+            patch_output(previous, next, m_edit_positions.of(plan, next.sequence->size(), index), (*next.sequence)[index]);
+    }
 
-        if (rhythm_hits == 0)
-            return 0;
-        else {
-            int step_hits = std::ceil(seq_length / rhythm_hits);
-            return rhythm.size() * step_hits;
+    // Every hit plays the next step of the sequence whatever its value, so an edit to the rhythm
+    // only changes the output if it turns a hit into a rest or back.
+    static void patch_rhythm_edit(state& previous, const state& next, size_t index) {
+        if (((*previous.rhythm)[index] != 0) == ((*next.rhythm)[index] != 0))
+            next.output.offer(previous.output.take());
+    }
+
+    // The transformed sequence, cut short at max_output, computed at most once per state.
+    const atoms& transform(const state& current) {
+        return current.output.get([&] {
+            const steps& seq    = *current.sequence;
+            const steps& rhythm = *current.rhythm;
+            size_t       length = weft::rhythm_length(seq, rhythm, current.length);
+
+            step_buffer::use output_use { m_output_seq };
+            steps&           output_seq = *output_use;
+            output_seq.resize(std::min(length, current.max_output));
+
+            // The plan covers the whole output, so a truncated output is generated directly.
+            if (auto plan = output_seq.size() == length ? weft::rhythm_plan(seq.size(), rhythm, current.mode, current.length) : nullptr)
+                weft::parallel_gather(seq, *plan, output_seq, current.threads);
+            else
+                weft::parallel_apply_rhythm(seq, rhythm, current.mode, output_seq, current.threads);
+
+            atoms transformed_seq(output_seq.begin(), output_seq.end());
+            m_stats.record_allocation(transformed_seq.size() * sizeof(atom));
+            return transformed_seq;
+        });
+    }
+
+
+    // Sends out the results of asynchronous bangs on the scheduler thread.
+    timer<> deliverer { this, MIN_FUNCTION {
+        while (auto result = m_background.take()) {
+            const atoms& transformed_seq = transform(*result->current);
+            result->timing.output(m_stats, transformed_seq.size());
+            send_output(output, transformed_seq, output_mode, m_delta);
         }
+        return {};
+    }};
+
+    background_worker<async_result<state>> m_background { [this] { deliverer.delay(0); } };
+
+
+    static const weft::rhythm_stepper& stepper(const state& current) {
+        return current.stepper.get([&] {
+            return weft::rhythm_stepper(*current.sequence, *current.rhythm, current.mode, current.length);
+        });
+    }
+
+    // Compute and send a single step of the transformed sequence without producing the rest of it.
+    void send_step(step_index index) {
+        auto current = m_state.read();
+
+        int32_t     value;
+        play_result result = play_step(stepper(*current), index, cursor, value);
+        if (result == play_result::too_long)
+            cerr << "the transformed sequence is too long to play step by step" << endl;
+        else if (result == play_result::played)
+            output.send(value);
     }
 };
 
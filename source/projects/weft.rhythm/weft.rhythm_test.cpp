@@ -6,6 +6,8 @@
 #include "c74_min_unittest.h"  // required unit test header
 #include "weft.rhythm.cpp"   // need the source of our object so that we can access it
 
+#include <filesystem>
+
 
 SCENARIO("Object produces correct output") {
     ext_main(nullptr);    // every unit test must call ext_main() once to configure the class
@@ -98,5 +100,177 @@ SCENARIO("Object produces correct output") {
                 REQUIRE(output[0] == expected);
             }
         }
+
+        WHEN("it is banged twice without any attribute changes") {
+            atoms rhythm = {1, 1, 0};
+            my_object.rhythm_pattern = rhythm;
+            my_object.bang();
+            my_object.bang();
+
+            THEN("the same transformed sequence is sent both times") {
+                auto& output = *c74::max::object_getoutput(my_object, 0);
+                atoms expected = {1, 1, 0, 5, 5, 0, 6, 6, 0, 4, 4, 0};
+                REQUIRE(output.size() == 2);
+                REQUIRE(output[0] == expected);
+                REQUIRE(output[1] == expected);
+            }
+
+            AND_WHEN("the length is changed and it is banged again") {
+                my_object.length = 6;
+                my_object.bang();
+
+                THEN("the transformed sequence is recomputed") {
+                    auto& output = *c74::max::object_getoutput(my_object, 0);
+                    atoms expected = {1, 1, 0, 5, 5, 0};
+                    REQUIRE(output.size() == 3);
+                    REQUIRE(output[2] == expected);
+                }
+            }
+        }
+
+        WHEN("it is given a rhythm pattern and is stepped through with 'next' and 'step'") {
+            atoms rhythm = {1, 1, 0, 1, 0};
+            my_object.rhythm_pattern = rhythm;
+            my_object.next();
+            my_object.next();
+            my_object.next();
+            my_object.step({8});
+            my_object.step({-1});
+
+            THEN("each message sends out the single step of the transformed sequence at that index") {
+                auto& output = *c74::max::object_getoutput(my_object, 0);
+                REQUIRE(output.size() == 5);
+                REQUIRE(output[0] == atoms{1});
+                REQUIRE(output[1] == atoms{1});
+                REQUIRE(output[2] == atoms{0});
+                REQUIRE(output[3] == atoms{6});
+                REQUIRE(output[4] == atoms{0});
+            }
+
+            AND_THEN("the cursor is moved past the last step sent out, wrapping at the end") {
+                REQUIRE(my_object.cursor == 0);
+            }
+        }
+
+        WHEN("it is given a long length and banged on one thread and then on four") {
+            atoms rhythm = {1, 1, 0, 1, 0};
+            my_object.rhythm_pattern = rhythm;
+            my_object.length = 100000;
+            my_object.bang();
+            my_object.threads = 4;
+            my_object.bang();
+
+            THEN("both bangs send out the same transformed sequence") {
+                auto& output = *c74::max::object_getoutput(my_object, 0);
+                REQUIRE(output.size() == 2);
+                REQUIRE(output[0].size() == 100000);
+                REQUIRE(output[1] == output[0]);
+                REQUIRE(int(output[1][99998]) == 4);
+            }
+        }
+
+        WHEN("it is banged and then sent the stats message") {
+            my_object.bang();
+            my_object.stats();
+
+            THEN("it sends out a dictionary of its statistics from the rightmost outlet") {
+                auto& stats = *c74::max::object_getoutput(my_object, 2);
+                REQUIRE(stats.size() == 1);
+                REQUIRE(stats[0][0] == symbol("dictionary"));
+            }
+        }
+
+        WHEN("it is banged and then single steps of the sequence and rhythm are edited") {
+            my_object.length = 16;
+            atoms rhythm = {1, 1, 0};
+            my_object.rhythm_pattern = rhythm;
+            my_object.bang();
+            my_object.setstep({2, 7});
+            my_object.setpattern({1, 3});
+            my_object.setstep({-1, 9});
+            my_object.bang();
+
+            THEN("the next bang sends out the transformed sequence with the edits applied") {
+                auto& output = *c74::max::object_getoutput(my_object, 0);
+                atoms expected = {1, 1, 0, 7, 5, 0, 6, 6, 0, 4, 9, 0, 1, 1, 0, 7};
+                REQUIRE(output.size() == 2);
+                REQUIRE(output[1] == expected);
+            }
+
+            AND_THEN("the attributes hold the edited steps") {
+                atoms edited_sequence = my_object.sequence.get();
+                atoms edited_rhythm   = my_object.rhythm_pattern.get();
+                REQUIRE(edited_sequence == atoms{1, 1, 7, 5, 6, 6, 4, 9});
+                REQUIRE(edited_rhythm == atoms{1, 3, 0});
+            }
+        }
+
+        WHEN("it sends delta output and is banged before and after an edit") {
+            my_object.length = 16;
+            atoms rhythm = {1, 1, 0};
+            my_object.rhythm_pattern = rhythm;
+            my_object.output_mode = output_modes::delta;
+            my_object.bang();
+            my_object.setstep({2, 7});
+            my_object.bang();
+
+            THEN("the first bang sends every step and the second only the steps that changed") {
+                auto& output = *c74::max::object_getoutput(my_object, 0);
+                atoms first  = {"delta", 16, 0, 1, 1, 1, 2, 0, 3, 5, 4, 5, 5, 0, 6, 6, 7, 6, 8, 0, 9, 4, 10, 4, 11, 0, 12, 1, 13, 1, 14, 0, 15, 5};
+                atoms second = {"delta", 16, 3, 7, 15, 7};
+                REQUIRE(output.size() == 2);
+                REQUIRE(output[0] == first);
+                REQUIRE(output[1] == second);
+            }
+        }
+
+        WHEN("its dest is set to something other than a list or a buffer~") {
+            atoms dest = {"matrix", "somewhere"};
+            my_object.dest = dest;
+            my_object.bang();
+
+            THEN("it keeps sending its output as a list") {
+                std::vector<symbol> kept = my_object.dest;
+                auto& output = *c74::max::object_getoutput(my_object, 0);
+                REQUIRE(kept == std::vector<symbol>{"list"});
+                REQUIRE(output.size() == 1);
+            }
+        }
+
+        WHEN("its output is written to a .weft file, which is then read back as its sequence") {
+            std::string path = (std::filesystem::temp_directory_path() / "weft.rhythm_test.weft").string();
+            atoms rhythm = {1, 0};
+            my_object.rhythm_pattern = rhythm;
+            my_object.write({path});
+            my_object.read({path});
+            my_object.bang();
+
+            THEN("bang transforms the written output again") {
+                auto& output = *c74::max::object_getoutput(my_object, 0);
+                atoms expected = {1, 0, 0, 0, 1, 0, 0, 0, 5, 0, 0, 0, 5, 0, 0, 0, 6, 0, 0, 0, 6, 0, 0, 0, 4, 0, 0, 0, 4, 0, 0, 0};
+                REQUIRE(output.size() == 1);
+                REQUIRE(output[0] == expected);
+            }
+            std::filesystem::remove(path);
+        }
+
+        WHEN("it is sent a batch of sequences in a dictionary") {
+            dict sequences { symbol("weft.rhythm_test.batch"), true };
+            sequences["first"]  = atoms {1, 2, 3};
+            sequences["second"] = atoms {4, 5};
+            atoms rhythm = {1, 0};
+            my_object.rhythm_pattern = rhythm;
+            my_object.batch({"weft.rhythm_test.batch"});
+
+            THEN("it sends out a dictionary of the transformed sequences") {
+                auto& output = *c74::max::object_getoutput(my_object, 0);
+                REQUIRE(output.size() == 1);
+                REQUIRE(output[0][0] == symbol("dictionary"));
+
+                dict transformed { symbol(output[0][1]) };
+                REQUIRE(atoms(transformed["first"]) == atoms {1, 0, 2, 0, 3, 0});
+                REQUIRE(atoms(transformed["second"]) == atoms {4, 0, 5, 0});
+            }
+        }
     }
 }
@@ -0,0 +1,130 @@
+/// @file
+///	@ingroup   weft
+///	@copyright Copyright 2020 Stephen Meyer. All rights reserved.
+///	@licence	     Use of this source code is governed by the MIT License found in the License.md file.
+
+#include "c74_min.h"
+#include "../weft.shared/weft.h"
+
+using namespace c74::min;
+
+
+class rhythm_tilde : public object<rhythm_tilde>, public vector_operator<> {
+public:
+    MIN_DESCRIPTION {"Play a sequence with a rhythmic pattern applied, at signal rate."};
+    MIN_TAGS        {"sequences, transformations, audio"};
+    MIN_AUTHOR      {"Steve Meyer"};
+    MIN_RELATED     {"weft.rhythm, weft.repeater~, phasor~"};
+
+
+    inlet<>  input  { this, "(signal) the step index to play, or a phasor with @input phasor." };
+    outlet<> output { this, "(signal) the step of the transformed sequence at the input.", "signal" };
+
+
+private:
+    // Everything the transform depends on, published as a whole whenever an attribute changes.
+    // The stepper is built by the setter so that the audio thread never allocates.
+    struct state {
+        shared_steps        sequence { make_steps({0}) };
+        shared_steps        rhythm   { make_steps({1}) };
+        int                 length   { -1 };
+        weft::fill_mode     mode     { weft::fill_mode::wrap };
+        signal_input        input    { signal_input::index };
+
+        std::shared_ptr<const weft::rhythm_stepper> stepper { build_stepper() };
+
+        std::shared_ptr<const weft::rhythm_stepper> build_stepper() const {
+            return std::make_shared<const weft::rhythm_stepper>(*sequence, *rhythm, mode, length);
+        }
+    };
+
+    snapshot<state> m_state { state {} };
+
+
+public:
+    attribute<symbol> input_mode { this, "input", "index",
+        description {"How the input signal is read: as a step index, or as a phasor that plays the whole transformed sequence once per cycle."},
+        range {"index", "phasor"},
+        setter { MIN_FUNCTION {
+            trace_scope traced { "weft.rhythm~ input" };
+            if (args.size() > 0)
+                m_state.update([&](state& s) { s.input = to_signal_input(args[0]); });
+            return args;
+        }}
+    };
+
+
+    attribute<int> length { this, "length", -1, description {"The length of the transformed sequence in steps."},
+        setter { MIN_FUNCTION {
+            trace_scope traced { "weft.rhythm~ length" };
+            if (args.size() > 0)
+                update([&](state& s) { s.length = int(args[0]); });
+            return args;
+        }}
+    };
+
+
+    attribute<symbol> fill_mode { this, "fill_mode", "wrap",
+        description {"The mode used to fill out a sequence when the length is longer than the transformed sequence."},
+        range {"wrap", "silence"},
+        setter { MIN_FUNCTION {
+            trace_scope traced { "weft.rhythm~ fill_mode" };
+            if (args.size() > 0)
+                update([&](state& s) { s.mode = to_fill_mode(args[0]); });
+            return args;
+        }}
+    };
+
+
+    attribute< vector<int> > sequence { this, "sequence", {0}, description {"The primary sequence to transform."},
+        setter { MIN_FUNCTION {
+            trace_scope traced { "weft.rhythm~ sequence" };
+            shared_steps parsed;
+            if (args.size() == 0 || !parse_ints(args, parsed))
+                return this->sequence;
+            else {
+                update([&](state& s) { s.sequence = parsed; });
+                return args;
+            }
+        }}
+    };
+
+
+    attribute< vector<int> > rhythm_pattern { this, "rhythm", {1}, description {"The rhythm pattern used to transform the primary sequence."},
+        setter { MIN_FUNCTION {
+            trace_scope traced { "weft.rhythm~ rhythm" };
+            shared_steps parsed;
+            if (args.size() == 0 || !parse_ints(args, parsed))
+                return this->rhythm_pattern;
+            else {
+                update([&](state& s) { s.rhythm = parsed; });
+                return args;
+            }
+        }}
+    };
+
+
+    void operator()(audio_bundle input, audio_bundle output) {
+        auto current = m_state.read();
+
+        auto in  = input.samples(0);
+        auto out = output.samples(0);
+
+        for (auto i = 0; i < input.frame_count(); ++i)
+            out[i] = signal_step(*current->stepper, in[i], current->input);
+    }
+
+
+private:
+    // Publish a change to the state, rebuilding its stepper.
+    template<class change_function>
+    void update(change_function change) {
+        m_state.update([&](state& s) {
+            change(s);
+            s.stepper = s.build_stepper();
+        });
+    }
+};
+
+
+MIN_EXTERNAL(rhythm_tilde);
@@ -0,0 +1,59 @@
+/// @file
+/// @ingroup   weft
+/// @copyright Copyright 2020 Stephen Meyer. All rights reserved.
+/// @license        Use of this source code is governed by the MIT License found in the License.md file.
+
+#include "c74_min_unittest.h"      // required unit test header
+#include "weft.rhythm_tilde.cpp"   // need the source of our object so that we can access it
+
+
+SCENARIO("Object produces correct output") {
+    ext_main(nullptr);    // every unit test must call ext_main() once to configure the class
+
+    GIVEN("An instance of weft.rhythm~ with a sequence and a rhythm") {
+
+        test_wrapper<rhythm_tilde> an_instance;
+        rhythm_tilde&             my_object = an_instance;
+        atoms sequence = {1, 5, 6};
+        atoms rhythm   = {1, 1, 0};
+        my_object.sequence = sequence;
+        my_object.rhythm_pattern = rhythm;
+
+        WHEN("it is given a signal of step indices") {
+            sample  input_samples[]   = {0, 1, 2, 3, 4, 8, -1};
+            sample  output_samples[7] = {};
+            sample* input_channels[]  = {input_samples};
+            sample* output_channels[] = {output_samples};
+
+            my_object(audio_bundle(input_channels, 1, 7), audio_bundle(output_channels, 1, 7));
+
+            THEN("it outputs the transformed step at each index, wrapping around the transformed sequence") {
+                REQUIRE(output_samples[0] == 1);
+                REQUIRE(output_samples[1] == 5);
+                REQUIRE(output_samples[2] == 0);
+                REQUIRE(output_samples[3] == 6);
+                REQUIRE(output_samples[4] == 1);
+                REQUIRE(output_samples[5] == 0);
+                REQUIRE(output_samples[6] == 0);
+            }
+        }
+
+        WHEN("it is given a phasor") {
+            my_object.input_mode = symbol("phasor");
+
+            sample  input_samples[]   = {0.0, 0.5, 0.99, 1.25};
+            sample  output_samples[4] = {};
+            sample* input_channels[]  = {input_samples};
+            sample* output_channels[] = {output_samples};
+
+            my_object(audio_bundle(input_channels, 1, 4), audio_bundle(output_channels, 1, 4));
+
+            THEN("each cycle of the phasor plays the whole transformed sequence") {
+                REQUIRE(output_samples[0] == 1);
+                REQUIRE(output_samples[1] == 6);
+                REQUIRE(output_samples[2] == 0);
+                REQUIRE(output_samples[3] == 5);
+            }
+        }
+    }
+}
@@ -1,70 +1,1665 @@
 #include "c74_min.h"
+#include "../weft.core/weft_core.h"
+#include "../weft.core/weft_chain.h"
+#include "../weft.core/weft_parallel.h"
+#include "../weft.core/weft_plan.h"
+#include "../weft.core/weft_trace.h"
+#include "../weft.core/weft_file.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
 #include <cmath>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <utility>
+#include <vector>
 
 
 using namespace c74::min;
 
 
-int calculate_length(const vector<int> &seq, const vector<int> &rhythm);
+// A sequence or pattern held by an object as plain integers, ready for the transforms. Shared so
+// that an object's state can be copied cheaply when one of its other attributes changes.
+using steps        = std::vector<int32_t>;
+using shared_steps = std::shared_ptr<const steps>;
 
 
-bool only_ints(atoms const &args) {
-    bool ints_only = true;
-    for (int i = 0; i < args.size(); i++)
-        try
-        {
-            float num = std::stof(args[i]);
+// Parse a list of atoms into integer steps. Each atom's type is inspected rather than its text:
+// ints are taken as they are, floats only when they hold a whole number, and anything else fails.
+// On failure `parsed` is left unchanged and false is returned.
+bool parse_ints(atoms const &args, steps &parsed) {
+    steps values(args.size());
+
+    for (size_t i = 0; i < args.size(); i++) {
+        if (args[i].a_type == c74::max::A_LONG)
+            values[i] = int(args[i]);
+        else if (args[i].a_type == c74::max::A_FLOAT) {
+            double num = args[i];
             if (std::floor(num) != num)
-            {
-                ints_only = false;
-                break;
+                return false;
+            values[i] = int32_t(num);
+        }
+        else
+            return false;
+    }
+
+    parsed = std::move(values);
+    return true;
+}
+
+
+bool parse_ints(atoms const &args, shared_steps &parsed) {
+    steps values;
+    if (!parse_ints(args, values))
+        return false;
+
+    parsed = std::make_shared<const steps>(std::move(values));
+    return true;
+}
+
+
+shared_steps make_steps(steps values) {
+    return std::make_shared<const steps>(std::move(values));
+}
+
+
+// Steps an object generates into before they become its output, kept for the object's lifetime so
+// that the buffer only grows while the object exists and is freed with it. A bang and an async
+// bang of the same object can generate at once; rather than wait, whichever finds the buffer in
+// use generates into one of its own.
+class step_buffer {
+public:
+    class use {
+    public:
+        explicit use(step_buffer &owner)
+        : m_owner  { owner }
+        , m_shared { !owner.m_in_use.exchange(true, std::memory_order_acquire) }
+        {}
+
+        use(const use&) = delete;
+        use& operator=(const use&) = delete;
+
+        ~use() {
+            if (m_shared)
+                m_owner.m_in_use.store(false, std::memory_order_release);
+        }
+
+        steps& operator*()  { return m_shared ? m_owner.m_steps : m_own; }
+        steps* operator->() { return &**this; }
+
+    private:
+        step_buffer &m_owner;
+        const bool   m_shared;
+        steps        m_own;
+    };
+
+private:
+    std::atomic<bool> m_in_use { false };
+    steps             m_steps;
+};
+
+
+weft::fill_mode to_fill_mode(const symbol &fill_mode) {
+    return fill_mode == symbol("silence") ? weft::fill_mode::silence : weft::fill_mode::wrap;
+}
+
+
+// The threads attribute, where 0 asks for every hardware thread.
+unsigned to_thread_count(int threads) {
+    return threads == 0 ? weft::hardware_threads() : unsigned(threads);
+}
+
+
+// A value derived from an object's state, such as its transformed sequence, computed on first use
+// and kept for the lifetime of that state. Safe to use from several threads without a lock: if two
+// threads compute it at once, one result is kept and the other discarded. Copying a state leaves
+// the copy's derived values to be computed afresh.
+template<class T>
+class lazy {
+public:
+    lazy() = default;
+    lazy(const lazy&) {}
+    lazy& operator=(const lazy&) = delete;
+
+    ~lazy() {
+        delete m_value.load();
+    }
+
+
+    template<class compute_function>
+    const T& get(compute_function compute) const {
+        const T* value = m_value.load(std::memory_order_acquire);
+
+        if (!value) {
+            const T* computed = new T(compute());
+            if (m_value.compare_exchange_strong(value, computed, std::memory_order_acq_rel))
+                value = computed;
+            else
+                delete computed;
+        }
+        return *value;
+    }
+
+
+    // The value if it has been computed, or nullptr.
+    const T* computed() const {
+        return m_value.load(std::memory_order_acquire);
+    }
+
+
+    // Give the value ahead of its first use, as an edit does with the value it carries over from
+    // the state before. Dropped if a reader has computed the value in the meantime.
+    void offer(std::unique_ptr<T> value) const {
+        const T* expected = nullptr;
+        if (m_value.compare_exchange_strong(expected, value.get(), std::memory_order_acq_rel))
+            value.release();
+    }
+
+
+    // Take the value, if computed, leaving it to be computed again. Only for a state that no reader
+    // can reach, as in snapshot::update's reuse.
+    std::unique_ptr<T> take() {
+        return std::unique_ptr<T>(const_cast<T*>(m_value.exchange(nullptr)));
+    }
+
+private:
+    mutable std::atomic<const T*> m_value { nullptr };
+};
+
+
+// An object's attribute state, published as a whole each time it changes so that bang can read it
+// without ever blocking.
+//
+// A reader holds the current state for as long as it needs it; doing so is wait-free. A writer
+// copies the current state, changes the copy and publishes it, then retires the old state. Each
+// state counts the readers holding it, and writers delete every retired state that no reader
+// holds, so a long reader keeps its own state alive and no other, however many are published
+// meanwhile.
+//
+// A reader finds the current state and then counts itself on it, so a writer could retire the
+// state in between. Readers count themselves as entering while they do, on one of two counters. A
+// writer that has retired a state switches later readers to the other counter and waits for the
+// first to empty, twice over, so that it only ever waits for readers part way through those few
+// instructions. After that, any reader of a retired state is counted on it.
+//
+// An object declares its snapshot ahead of its attributes, so that it exists when their setters run.
+template<class T>
+class snapshot {
+    struct node {
+        T                        value;
+        mutable std::atomic<int> readers { 0 };
+    };
+
+public:
+    explicit snapshot(T initial)
+    : m_current { new node { std::move(initial) } }
+    {}
+
+    snapshot(const snapshot&) = delete;
+    snapshot& operator=(const snapshot&) = delete;
+
+    ~snapshot() {
+        delete m_current.load();
+        for (node* state : m_retired)
+            delete state;
+    }
+
+
+    // Movable, so that a result can carry the state it was computed from; a reader moved from holds
+    // nothing. It must not outlive the snapshot.
+    class reader {
+    public:
+        explicit reader(const snapshot& owner)
+        : m_state { owner.acquire() }
+        {}
+
+        reader(reader&& other) noexcept
+        : m_state { std::exchange(other.m_state, nullptr) }
+        {}
+
+        reader& operator=(reader&& other) noexcept {
+            if (this != &other) {
+                release();
+                m_state = std::exchange(other.m_state, nullptr);
             }
+            return *this;
         }
-        catch (...)
-        {
-            ints_only = false;
+
+        ~reader() {
+            release();
+        }
+
+        const T& operator*() const  { return m_state->value; }
+        const T* operator->() const { return &m_state->value; }
+
+    private:
+        void release() {
+            if (m_state)
+                m_state->readers.fetch_sub(1);
+        }
+
+        const node* m_state;
+    };
+
+
+    // Hold the current state until the returned reader goes out of scope.
+    reader read() const {
+        return reader { *this };
+    }
+
+
+    // Publish a copy of the current state with `change` applied to it.
+    template<class change_function>
+    void update(change_function change) {
+        update(change, [](T&, const T&) {});
+    }
+
+
+    // As above, then, if no reader holds the state just replaced, let `reuse(previous, next)` take
+    // what it wants from it before it is deleted. The new state is already published, so `reuse`
+    // may only hand things to it through lazy::offer.
+    template<class change_function, class reuse_function>
+    void update(change_function change, reuse_function reuse) {
+        std::lock_guard<std::mutex> lock {m_writer};
+
+        node* next = new node { m_current.load()->value };
+        change(next->value);
+
+        node* previous = m_current.exchange(next);
+        wait_for_entering();
+        if (previous->readers.load() == 0)
+            reuse(previous->value, next->value);
+
+        m_retired.push_back(previous);
+        std::erase_if(m_retired, [](node* state) {
+            if (state->readers.load() != 0)
+                return false;
+            delete state;
+            return true;
+        });
+    }
+
+private:
+    const node* acquire() const {
+        std::atomic<int>& entering = m_entering[m_phase.load() & 1];
+        entering.fetch_add(1);
+
+        const node* state = m_current.load();
+        state->readers.fetch_add(1);
+
+        entering.fetch_sub(1);
+        return state;
+    }
+
+    // Twice, as a reader may have read the phase just before the last writer switched it and only
+    // counted itself on the counter it found afterwards.
+    void wait_for_entering() {
+        for (int pass = 0; pass < 2; pass++) {
+            unsigned previous = m_phase.fetch_add(1) & 1;
+            while (m_entering[previous].load() != 0)
+                std::this_thread::yield();
+        }
+    }
+
+    std::atomic<node*>               m_current;
+    mutable std::atomic<int>         m_entering[2] { 0, 0 };
+    std::atomic<unsigned>            m_phase { 0 };
+    std::mutex                       m_writer;  // serializes writers only; readers never take it
+    std::vector<node*>               m_retired;
+};
+
+
+// One-step edits, as the setstep and setpattern messages make. Rather than leave the new state's
+// output to be rebuilt on the next bang, an edit works out which output steps the changed step
+// affects and patches the previous output in place. It can only take that output once no bang is
+// still reading the state it belongs to; an edit made during a bang leaves the output to be rebuilt.
+//
+// Read `<index> <value>` from an edit message's arguments.
+bool parse_edit(const atoms &args, long &index, int32_t &value) {
+    steps parsed;
+    if (args.size() != 2 || !parse_ints(args, parsed))
+        return false;
+
+    index = parsed[0];
+    value = parsed[1];
+    return true;
+}
+
+
+// Publish a state with step `index` of its steps `member` set to `value`, where a negative index
+// counts back from the end. Then `patch(previous, next, index)` can move the previous state's
+// output over to the new state. Returns false, keeping the output as it was, if the index is out
+// of range.
+template<class state_type, class patch_function>
+bool edit_steps(snapshot<state_type> &states, shared_steps state_type::*member, long index, int32_t value, patch_function patch) {
+    bool edited = false;
+
+    states.update([&](state_type &next) {
+        const steps &values = *(next.*member);
+        if (index < 0)
+            index += long(values.size());
+        if (index < 0 || size_t(index) >= values.size())
+            return;
+
+        steps changed = values;
+        changed[index] = value;
+        next.*member   = make_steps(std::move(changed));
+        edited         = true;
+    },
+    [&](state_type &previous, const state_type &next) {
+        if (edited)
+            patch(previous, next, size_t(index));
+        else
+            next.output.offer(previous.output.take());
+    });
+    return edited;
+}
+
+
+// The value of an attribute that edits change, read from the state. Those attributes have this as
+// their getter so that an edit needn't set them, which would parse every step again.
+template<class state_type>
+atoms state_steps(const snapshot<state_type> &states, shared_steps state_type::*member) {
+    auto         current = states.read();
+    const steps &values  = *((*current).*member);
+    return atoms(values.begin(), values.end());
+}
+
+
+// The inverse of the plan behind an object's last sequence edit, kept for the next one, which
+// almost always has the same plan. Only edits use it, and they hold the state's writer lock.
+class edit_positions {
+public:
+    // The output steps that play sequence step `index` under `plan`.
+    std::span<const size_t> of(const std::shared_ptr<const weft::index_plan> &plan, size_t seq_size, size_t index) {
+        if (plan != m_plan) {
+            m_inverse = weft::plan_inverse(*plan, seq_size);
+            m_plan    = plan;
         }
+        return m_inverse.positions(index);
+    }
+
+private:
+    std::shared_ptr<const weft::index_plan> m_plan;
+    weft::plan_inverse                      m_inverse;
+};
+
+
+// Move the previous state's output, which must have been computed, over to the next with `value`
+// at each of `positions`.
+template<class state_type>
+void patch_output(state_type &previous, const state_type &next, std::span<const size_t> positions, int32_t value) {
+    std::unique_ptr<atoms> output = previous.output.take();
+    for (size_t position : positions)
+        (*output)[position] = value;
+    next.output.offer(std::move(output));
+}
+
+
+// Tracing. One tracer is shared by every weft object in the process, whichever external it belongs
+// to. Each external has its own copy of this code, so the tracer is kept where all of them can find
+// it: on a Max symbol, created by whichever external asks for it first. weft.profile turns it on
+// and writes it out.
+weft::tracer& shared_tracer() {
+    // Objects are made on the main thread, and trace their attribute setters as they are made, so
+    // each external's first call comes from the main thread.
+    static weft::tracer& shared = []() -> weft::tracer& {
+        c74::max::t_symbol* key = c74::max::gensym("__weft_tracer__");
+        if (!key->s_thing)
+            key->s_thing = reinterpret_cast<c74::max::t_object*>(new weft::tracer);
+        return *reinterpret_cast<weft::tracer*>(key->s_thing);
+    }();
+    return shared;
+}
+
 
-    return ints_only;
+// The thread pool is kept on a Max symbol in the same way, so that every external runs its parallel
+// work on the same workers rather than starting a pool of its own. Each external points its copy of
+// weft_core at the pool as it loads, on the main thread, before any parallel work can run.
+weft::thread_pool& shared_thread_pool() {
+    c74::max::t_symbol* key = c74::max::gensym("__weft_thread_pool__");
+    if (!key->s_thing)
+        key->s_thing = reinterpret_cast<c74::max::t_object*>(weft::make_thread_pool());
+    return *reinterpret_cast<weft::thread_pool*>(key->s_thing);
 }
 
+static const bool thread_pool_shared = (weft::share_thread_pool(shared_thread_pool()), true);
+
+
+// And so is the index plan cache, so that objects in different externals share plans, and one budget.
+weft::plan_cache& shared_plan_cache() {
+    c74::max::t_symbol* key = c74::max::gensym("__weft_plan_cache__");
+    if (!key->s_thing)
+        key->s_thing = reinterpret_cast<c74::max::t_object*>(weft::make_plan_cache());
+    return *reinterpret_cast<weft::plan_cache*>(key->s_thing);
+}
+
+static const bool plan_cache_shared = (weft::share_plan_cache(shared_plan_cache()), true);
+
 
-int calculate_length(const vector<int> &seq, const vector<int> &rhythm) {
-    int rhythm_hits = 0;
-    float seq_length = seq.size();
-    for (int i = 0; i < rhythm.size(); i++) {
-        if (rhythm[i] != 0)
-            rhythm_hits++;
+// Records a begin event when it is made and the matching end event when it goes out of scope, if
+// tracing was on when it was made. Costs one atomic load while tracing is off.
+class trace_scope {
+public:
+    explicit trace_scope(const char* name)
+    : m_name { shared_tracer().enabled() ? name : nullptr }
+    {
+        if (m_name)
+            shared_tracer().begin(m_name);
     }
 
-    if (rhythm_hits == 0)
-        return 0;
-    else {
-        int step_hits = std::ceil(seq_length / rhythm_hits);
-        return rhythm.size() * step_hits;
+    trace_scope(const trace_scope&) = delete;
+    trace_scope& operator=(const trace_scope&) = delete;
+
+    ~trace_scope() {
+        if (m_name)
+            shared_tracer().end(m_name);
+    }
+
+private:
+    const char* m_name;
+};
+
+
+// An outlet whose sends are traced under `name`, which should say which object and outlet it is.
+class traced_outlet : public outlet<> {
+public:
+    template<class... outlet_args>
+    traced_outlet(object_base* owner, const char* name, outlet_args&&... args)
+    : outlet<> { owner, std::forward<outlet_args>(args)... }
+    , m_name { name }
+    {}
+
+    template<class... value_types>
+    void send(value_types&&... values) {
+        trace_scope traced { m_name };
+        outlet<>::send(std::forward<value_types>(values)...);
+    }
+
+private:
+    const char* m_name;
+};
+
+
+// Per-object performance counters, cheap enough to leave on in a running patch: recording a bang
+// only adds to atomics, and nothing takes a lock. Bang latencies go into a histogram of nanoseconds
+// with four buckets per power of two, so the percentiles read back are rounded up by at most a
+// quarter. The allocations counted are the lists the object builds for its outputs.
+class bang_stats {
+public:
+    using clock = std::chrono::steady_clock;
+
+    class scope;
+
+
+    // A bang whose output is made somewhere else, as an async bang's is. It's recorded once its
+    // output is ready, or not at all if that output is dropped.
+    class pending {
+    public:
+        void output(bang_stats &stats, size_t steps) const {
+            stats.record(m_input_steps, steps, clock::now() - m_started);
+        }
+
+    private:
+        friend class scope;
+
+        pending(size_t input_steps, clock::time_point started)
+        : m_input_steps { input_steps }
+        , m_started { started }
+        {}
+
+        size_t            m_input_steps;
+        clock::time_point m_started;
+    };
+
+
+    // Records one bang when it goes out of scope, timed from when it was made until its output was
+    // ready, so that the time the patch below takes over the output isn't counted.
+    class scope {
+    public:
+        scope(bang_stats &stats, size_t input_steps)
+        : m_stats { stats }
+        , m_input_steps { input_steps }
+        , m_started { clock::now() }
+        {}
+
+        scope(const scope&) = delete;
+        scope& operator=(const scope&) = delete;
+
+        ~scope() {
+            if (m_deferred)
+                return;
+            clock::time_point finished = m_finished == clock::time_point {} ? clock::now() : m_finished;
+            m_stats.record(m_input_steps, m_output_steps, finished - m_started);
+        }
+
+        // Note that the output is ready to send.
+        void output(size_t steps) {
+            m_output_steps = steps;
+            m_finished     = clock::now();
+        }
+
+        // Leave the bang to be recorded by whoever makes its output.
+        pending defer() {
+            m_deferred = true;
+            return { m_input_steps, m_started };
+        }
+
+    private:
+        bang_stats&       m_stats;
+        size_t            m_input_steps;
+        size_t            m_output_steps { 0 };
+        clock::time_point m_started;
+        clock::time_point m_finished;
+        bool              m_deferred { false };
+    };
+
+
+    void record(size_t input_steps, size_t output_steps, clock::duration latency) {
+        uint64_t nanoseconds = uint64_t(std::max<int64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(latency).count(), 0));
+
+        m_bangs.fetch_add(1, std::memory_order_relaxed);
+        m_input_steps.store(input_steps, std::memory_order_relaxed);
+        m_output_steps.store(output_steps, std::memory_order_relaxed);
+        m_total_output_steps.fetch_add(output_steps, std::memory_order_relaxed);
+        m_latencies[bucket(nanoseconds)].fetch_add(1, std::memory_order_relaxed);
+
+        uint64_t longest = m_longest.load(std::memory_order_relaxed);
+        while (nanoseconds > longest && !m_longest.compare_exchange_weak(longest, nanoseconds, std::memory_order_relaxed))
+            ;
+    }
+
+
+    void record_allocation(size_t bytes) {
+        m_allocations.fetch_add(1, std::memory_order_relaxed);
+        m_allocated_bytes.fetch_add(bytes, std::memory_order_relaxed);
+    }
+
+
+    // Bangs that are recording while this runs may be counted or lost, but never half counted.
+    void reset() {
+        m_bangs.store(0);
+        m_input_steps.store(0);
+        m_output_steps.store(0);
+        m_total_output_steps.store(0);
+        m_allocations.store(0);
+        m_allocated_bytes.store(0);
+        m_longest.store(0);
+        for (auto& count : m_latencies)
+            count.store(0);
+    }
+
+
+    // Fill `d` with the counters, with latencies in microseconds.
+    void write(dict &d) const {
+        d["bangs"]              = to_long(m_bangs.load());
+        d["input_steps"]        = to_long(m_input_steps.load());
+        d["output_steps"]       = to_long(m_output_steps.load());
+        d["total_output_steps"] = to_long(m_total_output_steps.load());
+        d["latency_p50_us"]     = percentile(0.5) / 1000.0;
+        d["latency_p99_us"]     = percentile(0.99) / 1000.0;
+        d["latency_max_us"]     = m_longest.load() / 1000.0;
+        d["allocations"]        = to_long(m_allocations.load());
+        d["allocated_bytes"]    = to_long(m_allocated_bytes.load());
+    }
+
+private:
+    static constexpr size_t bucket_count = 256;
+
+
+    // Latencies under 4ns get a bucket each. Above that, bucket by the position of the highest set
+    // bit and the two bits below it.
+    static size_t bucket(uint64_t nanoseconds) {
+        if (nanoseconds < 4)
+            return size_t(nanoseconds);
+
+        int top_bit = std::bit_width(nanoseconds) - 1;
+        return size_t(top_bit - 1) * 4 + size_t((nanoseconds >> (top_bit - 2)) & 3);
+    }
+
+
+    // The longest latency that falls in a bucket.
+    static uint64_t bucket_top(size_t index) {
+        if (index < 4)
+            return index;
+
+        int      top_bit = int(index / 4) + 1;
+        uint64_t quarter = index % 4;
+        if (top_bit == 63 && quarter == 3)
+            return std::numeric_limits<uint64_t>::max();
+        return ((5 + quarter) << (top_bit - 2)) - 1;
+    }
+
+
+    double percentile(double fraction) const {
+        std::array<uint64_t, bucket_count> counts;
+        uint64_t                           total = 0;
+        for (size_t i = 0; i < bucket_count; i++)
+            total += counts[i] = m_latencies[i].load(std::memory_order_relaxed);
+
+        if (total == 0)
+            return 0.0;
+
+        uint64_t rank = std::max<uint64_t>(uint64_t(std::ceil(fraction * total)), 1);
+        uint64_t seen = 0;
+        for (size_t i = 0; i < bucket_count; i++) {
+            seen += counts[i];
+            if (seen >= rank)
+                return double(std::min(bucket_top(i), m_longest.load()));
+        }
+        return double(m_longest.load());
+    }
+
+
+    static c74::max::t_atom_long to_long(uint64_t value) {
+        return c74::max::t_atom_long(std::min<uint64_t>(value, std::numeric_limits<c74::max::t_atom_long>::max()));
+    }
+
+
+    std::atomic<uint64_t>                            m_bangs              { 0 };
+    std::atomic<uint64_t>                            m_input_steps        { 0 };
+    std::atomic<uint64_t>                            m_output_steps       { 0 };
+    std::atomic<uint64_t>                            m_total_output_steps { 0 };
+    std::atomic<uint64_t>                            m_allocations        { 0 };
+    std::atomic<uint64_t>                            m_allocated_bytes    { 0 };
+    std::atomic<uint64_t>                            m_longest            { 0 };
+    std::array<std::atomic<uint64_t>, bucket_count>  m_latencies          {};
+};
+
+
+// Send the counters from `out` as a dictionary, as the stats message does.
+void send_stats(const bang_stats &stats, traced_outlet &out) {
+    dict counters { symbol(true) };
+    stats.write(counters);
+    out.send("dictionary", counters.name());
+}
+
+
+// Guarding against outputs too long to hold. A bang whose output would be longer than the object's
+// max_output attribute either cuts it short, streams it out in lists of at most max_output steps,
+// or refuses to send anything, as the overflow attribute says, before allocating any of it.
+enum class overflow_action { truncate, stream, refuse };
+
+constexpr int default_max_output = 1 << 22;
+
+
+overflow_action to_overflow_action(const symbol &action) {
+    if (action == symbol("truncate"))
+        return overflow_action::truncate;
+    else if (action == symbol("stream"))
+        return overflow_action::stream;
+    else
+        return overflow_action::refuse;
+}
+
+
+// The max_output attribute, where 0 lifts the limit.
+size_t to_output_limit(int max_output) {
+    return max_output == 0 ? weft::overflowed_length : size_t(max_output);
+}
+
+
+// A length as sent out by getlength. A length too long to count is sent as the largest number an
+// atom holds.
+c74::max::t_atom_long to_atom_length(size_t length) {
+    constexpr auto largest = std::numeric_limits<c74::max::t_atom_long>::max();
+    return length > size_t(largest) ? largest : c74::max::t_atom_long(length);
+}
+
+
+// Send the stepper's output in lists of at most `chunk` steps, so that only one list is held at a
+// time.
+template<class stepper_type>
+void stream_steps(const stepper_type &stepper, size_t chunk, traced_outlet &out) {
+    size_t length = stepper.length();
+    atoms  list;
+    list.reserve(std::min(chunk, length));
+
+    for (size_t start = 0; start < length; start += chunk) {
+        size_t end = start + std::min(chunk, length - start);
+
+        list.clear();
+        for (size_t index = start; index < end; index++)
+            list.push_back(stepper.at(index));
+        out.send(list);
     }
 }
 
 
-void apply_rhythm(atoms &transformed_seq, const vector<int> &seq, const vector<int> &rhythm, const int &length, const symbol fill_mode) {
+// Delta output. With @output delta, bang sends a `delta` message instead of the whole list: the
+// output's length, then an index and value for each step that differs from the output sent before
+// it. Steps past the end of the previous output all count as changed, so the first bang sends
+// every step.
+enum class output_modes : int { list, delta, enum_count };
+
+const enum_map output_modes_range = {"list", "delta"};
+
+
+// The output last sent, kept as steps so that the next can be compared against it with the vector
+// kernels. Bang and the delivery of asynchronous results can run on different threads, so it
+// takes a lock.
+class output_delta {
+public:
+    // Send the changes from the last output to `output` from `out`.
+    void send(traced_outlet &out, const atoms &output) {
+        atoms message;
+        {
+            std::lock_guard<std::mutex> lock {m_mutex};
+
+            m_next.resize(output.size());
+            for (size_t i = 0; i < output.size(); i++)
+                m_next[i] = int32_t(int(output[i]));
+
+            m_changed.clear();
+            weft::changed_steps(m_previous, m_next, m_changed);
+
+            message.reserve(2 + 2 * m_changed.size());
+            message.push_back("delta");
+            message.push_back(to_atom_length(m_next.size()));
+            for (size_t index : m_changed) {
+                message.push_back(to_atom_length(index));
+                message.push_back(m_next[index]);
+            }
+            std::swap(m_previous, m_next);
+        }
+        out.send(message);
+    }
 
-    int transformed_seq_length;
-    if (length >= 1)
-        // If a length greater than or equal to 1 has been specified, use it.
-        transformed_seq_length = length;
+
+    // Forget the last output, so that the next is sent whole, as when it was sent some other way.
+    void reset() {
+        std::lock_guard<std::mutex> lock {m_mutex};
+        m_previous.clear();
+    }
+
+private:
+    std::mutex          m_mutex;
+    steps               m_previous;
+    steps               m_next;
+    std::vector<size_t> m_changed;
+};
+
+
+// Send a bang's output as the object's output attribute says.
+void send_output(traced_outlet &out, const atoms &output, output_modes mode, output_delta &delta) {
+    if (mode == output_modes::delta)
+        delta.send(out, output);
     else
-        // Otherwise calculate the length by applying the rhythmic transformation to all steps in the sequence
-        transformed_seq_length = calculate_length(seq, rhythm);
+        out.send(output);
+}
+
 
-    int processed_step_index = 0;
-    for (int i = 0; i < transformed_seq_length; i++) {
-        int rhythm_step = rhythm[i % rhythm.size()];
+// Batch transforms, for generating many variations at once. The batch message names a dictionary
+// whose entries each hold a sequence. Every sequence is transformed with the object's current
+// attributes, shared out between every hardware thread, and the results are sent as a new
+// dictionary with the same keys. Outputs are cut short at max_output, since a batch can't be
+// streamed. Entries that aren't lists of integers, or whose output is too long to count or can't
+// be allocated, are left out.
+//
+// `length_of(seq_size)` gives the length of a transformed sequence, cut short at max_output, and
+// `transform(seq, out)` fills `out`, of that length, with it. Both run on the pool's threads, so
+// they mustn't call into Max. Returns false if there is no dictionary called `name`.
+template<class length_function, class transform_function>
+bool send_batch(symbol name, length_function length_of, transform_function transform, traced_outlet &out) {
+    c74::max::t_dictionary* source = c74::max::dictobj_findregistered_retain(name);
+    if (!source)
+        return false;
+
+    long                 key_count = 0;
+    c74::max::t_symbol** keys      = nullptr;
+    c74::max::dictionary_getkeys(source, &key_count, &keys);
+
+    std::vector<c74::max::t_symbol*> names;
+    std::vector<steps>               sequences;
+    for (long i = 0; i < key_count; i++) {
+        long              argc = 0;
+        c74::max::t_atom* argv = nullptr;
+        steps             parsed;
+
+        if (c74::max::dictionary_getatoms(source, keys[i], &argc, &argv) == c74::max::MAX_ERR_NONE && argc > 0
+            && parse_ints(atoms(argv, argv + argc), parsed)) {
+            names.push_back(keys[i]);
+            sequences.push_back(std::move(parsed));
+        }
+    }
+    c74::max::dictionary_freekeys(source, key_count, keys);
+    c74::max::dictobj_release(source);
+
+    std::vector<steps> results(sequences.size());
+    std::vector<char>  failed(sequences.size(), false);
+    unsigned           threads = weft::hardware_threads();
+
+    weft::parallel_for(sequences.size(), std::max<size_t>(1, sequences.size() / (size_t(threads) * 8)), threads, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            size_t length = length_of(sequences[i].size());
+            if (length == weft::overflowed_length) {
+                failed[i] = true;
+                continue;
+            }
+            try {
+                results[i].resize(length);
+                transform(sequences[i], results[i]);
+            }
+            catch (const std::exception&) {
+                failed[i] = true;
+            }
+        }
+    });
+
+    dict transformed { symbol(true) };
+    for (size_t i = 0; i < names.size(); i++) {
+        if (!failed[i])
+            transformed[symbol(names[i])] = atoms(results[i].begin(), results[i].end());
+    }
+    out.send("dictionary", transformed.name());
+    return true;
+}
 
-        if (rhythm_step == 0 || (processed_step_index >= seq.size() && fill_mode == symbol("silence")))
-            transformed_seq.push_back(0);
+
+// Jitter matrices. The jit_matrix message names a one-plane long matrix of one or two dimensions,
+// whose rows are each a sequence. Every row is transformed with the object's current attributes,
+// shared out between threads as a batch is, into the matching row of a matrix the object owns,
+// which is then sent on as jit_matrix. Rows are read from and written to the matrices' data where
+// it lies, never through atoms. Output rows are cut short at max_output, and a matrix whose rows
+// transform to nothing sends nothing, as Jitter has no empty matrices.
+
+
+// Holds a matrix's lock, so that no other object changes it while its data is in use.
+class matrix_lock {
+public:
+    explicit matrix_lock(void* matrix)
+    : m_matrix { matrix }
+    , m_saved { c74::max::jit_object_method(matrix, c74::max::_jit_sym_lock, reinterpret_cast<void*>(1)) }
+    {}
+
+    ~matrix_lock() {
+        c74::max::jit_object_method(m_matrix, c74::max::_jit_sym_lock, m_saved);
+    }
+
+    matrix_lock(const matrix_lock&) = delete;
+    matrix_lock& operator=(const matrix_lock&) = delete;
+
+private:
+    void* m_matrix;
+    void* m_saved;
+};
+
+
+// An object's output matrix, registered under a name of its own and resized to fit each output.
+class matrix_output {
+public:
+    matrix_output() = default;
+
+    matrix_output(const matrix_output&) = delete;
+    matrix_output& operator=(const matrix_output&) = delete;
+
+    ~matrix_output() {
+        if (m_matrix)
+            c74::max::jit_object_free(m_matrix);
+    }
+
+
+    // Transform the rows of `source`, which the caller has locked, into the output matrix, and
+    // return its name, or nullptr if nothing came of it.
+    template<class length_function, class transform_function>
+    c74::max::t_symbol* fill(void* source, const c74::max::t_jit_matrix_info &source_info, length_function length_of, transform_function transform) {
+        using namespace c74::max;
+
+        long   rows   = source_info.dimcount == 2 ? source_info.dim[1] : 1;
+        size_t length = length_of(size_t(source_info.dim[0]));
+        if (length == 0 || length == weft::overflowed_length || rows < 1)
+            return nullptr;
+
+        std::lock_guard<std::mutex> lock {m_mutex};
+
+        // A matrix can't be transformed into itself, as resizing it would free the rows being read.
+        if (source == m_matrix)
+            return nullptr;
+
+        if (!m_matrix) {
+            t_jit_matrix_info info;
+            jit_matrix_info_default(&info);
+            info.type       = _jit_sym_long;
+            info.planecount = 1;
+            m_name          = jit_symbol_unique();
+            m_matrix        = jit_object_register(jit_object_new(_jit_sym_jit_matrix, &info), m_name);
+            if (!m_matrix)
+                return nullptr;
+        }
+
+        t_jit_matrix_info info;
+        jit_object_method(m_matrix, _jit_sym_getinfo, &info);
+        info.type       = _jit_sym_long;
+        info.planecount = 1;
+        info.dimcount   = source_info.dimcount;
+        info.dim[0]     = long(length);
+        info.dim[1]     = rows;
+        jit_object_method(m_matrix, _jit_sym_setinfo, &info);
+        jit_object_method(m_matrix, _jit_sym_getinfo, &info);
+
+        matrix_lock locked { m_matrix };
+        char*       data        = matrix_data(m_matrix);
+        char*       source_data = matrix_data(source);
+        if (!data || !source_data || size_t(info.dim[0]) != length)
+            return nullptr;
+
+        unsigned threads = weft::hardware_threads();
+        weft::parallel_for(size_t(rows), 1, threads, [&](size_t begin, size_t end) {
+            for (size_t row = begin; row < end; row++) {
+                auto seq = reinterpret_cast<const int32_t*>(source_data + row * source_info.dimstride[1]);
+                auto out = reinterpret_cast<int32_t*>(data + row * info.dimstride[1]);
+                transform(std::span<const int32_t>(seq, size_t(source_info.dim[0])), std::span<int32_t>(out, length));
+            }
+        });
+        return m_name;
+    }
+
+
+private:
+    static char* matrix_data(void* matrix) {
+        char* data = nullptr;
+        c74::max::jit_object_method(matrix, c74::max::_jit_sym_getdata, &data);
+        return data;
+    }
+
+    std::mutex          m_mutex;
+    void*               m_matrix {nullptr};
+    c74::max::t_symbol* m_name   {nullptr};
+};
+
+
+// Transform the rows of the matrix called `name` into `output` and send it on. `length_of` and
+// `transform` are as for send_batch, and likewise run on the pool's threads. Returns false if
+// there is no one-plane long matrix of one or two dimensions called `name`.
+template<class length_function, class transform_function>
+bool send_matrix(symbol name, length_function length_of, transform_function transform, matrix_output &output, traced_outlet &out) {
+    using namespace c74::max;
+
+    void* source = jit_object_findregistered(name);
+    if (!source)
+        return false;
+
+    t_jit_matrix_info info;
+    jit_object_method(source, _jit_sym_getinfo, &info);
+    if (info.type != _jit_sym_long || info.planecount != 1 || info.dimcount < 1 || info.dimcount > 2 || info.dim[0] < 1)
+        return false;
+
+    t_symbol* sent = nullptr;
+    {
+        matrix_lock locked { source };
+        sent = output.fill(source, info, length_of, transform);
+    }
+    if (sent)
+        out.send("jit_matrix", symbol(sent));
+    return true;
+}
+
+
+// Sequences from and to outside the object.
+//
+// With @source buffer <name>, bang reads the sequence from the first channel of the named buffer~,
+// rounding each sample to a step, in place of the sequence attribute. With @dest buffer <name>,
+// bang writes the transformed sequence into every channel of the named buffer~, resized to fit,
+// and sends no list, so that index~, play~ and the like can look steps up without any messages.
+// Either way the buffer is locked only while its samples are copied.
+//
+// With @source file <path>, or after read <path>, bang transforms the first lane of a .weft file
+// straight from memory the file is mapped into. The write message transforms every lane of that
+// file, or else the one sequence bang would, and writes the results to a new .weft file a lane at
+// a time. Paths are resolved as Max resolves any other file's, so a bare name is looked for on the
+// search path to read, and goes in the default folder to write.
+//
+// Outputs are cut short at max_output. A bang that uses a buffer or file always runs on the
+// calling thread, whatever @async says, and never streams.
+//
+// @dest is `list`, for the outlet, or `buffer` and a buffer~'s name. @source may also be `file`
+// and a path.
+bool parse_buffer_target(const atoms &args, c74::max::t_symbol* &name) {
+    if (args.size() == 1 && args[0].a_type == c74::max::A_SYM && symbol(args[0]) == symbol("list")) {
+        name = nullptr;
+        return true;
+    }
+    if (args.size() == 2 && args[0].a_type == c74::max::A_SYM && symbol(args[0]) == symbol("buffer") && args[1].a_type == c74::max::A_SYM) {
+        name = symbol(args[1]);
+        return true;
+    }
+    return false;
+}
+
+
+// A file to read, named as Max names files: by a path, or by a bare name that Max looks for on its
+// search path. Returns false if there is no such file.
+bool resolve_file(const std::string &name, std::string &resolved) {
+    using namespace c74::max;
+
+    char     filename[MAX_PATH_CHARS];
+    short    folder = 0;
+    t_fourcc type   = 0;
+    strncpy_zero(filename, name.c_str(), MAX_PATH_CHARS);
+    if (locatefile_extended(filename, &folder, &type, nullptr, 0) != 0)
+        return false;
+
+    char absolute[MAX_PATH_CHARS];
+    if (path_toabsolutesystempath(folder, filename, absolute) != 0)
+        return false;
+    resolved = absolute;
+    return true;
+}
+
+
+// A file to write, which needn't exist yet: a path whose folder exists, or a bare name, which goes
+// in Max's default folder. Returns false if the path can't be made absolute.
+bool resolve_new_file(const std::string &name, std::string &resolved) {
+    using namespace c74::max;
+
+    char  filename[MAX_PATH_CHARS];
+    short folder = 0;
+    if (path_frompotentialpathname(name.c_str(), &folder, filename) != 0) {
+        folder = path_getdefault();
+        strncpy_zero(filename, name.c_str(), MAX_PATH_CHARS);
+    }
+
+    char absolute[MAX_PATH_CHARS];
+    if (path_toabsolutesystempath(folder, filename, absolute) != 0)
+        return false;
+    resolved = absolute;
+    return true;
+}
+
+
+class sequence_io {
+public:
+    // Set @source from its attribute's arguments, mapping the file it names, if any. Returns
+    // false, with `problem` saying why, if they aren't valid or the file can't be read.
+    bool set_source(const atoms &args, std::string &problem) {
+        c74::max::t_symbol* name;
+        if (parse_buffer_target(args, name)) {
+            m_source.update([&](sequence_source& s) { s = { name, nullptr }; });
+            return true;
+        }
+
+        if (args.size() != 2 || args[0].a_type != c74::max::A_SYM || symbol(args[0]) != symbol("file") || args[1].a_type != c74::max::A_SYM) {
+            problem = "source must be list, buffer and the name of a buffer~, or file and the path of a .weft file";
+            return false;
+        }
+
+        std::string file_name = args[1];
+        std::string path;
+        if (!resolve_file(file_name, path)) {
+            problem = "couldn't find " + file_name;
+            return false;
+        }
+
+        weft::file_status status;
+        auto              file = weft::sequence_file::open(path, status);
+        if (!file) {
+            problem = "couldn't read " + path + ": " + weft::describe(status);
+            return false;
+        }
+        if (file->lanes() == 0) {
+            problem = "couldn't read " + path + ": it has no lanes";
+            return false;
+        }
+
+        m_source.update([&](sequence_source& s) { s = { nullptr, std::move(file) }; });
+        return true;
+    }
+
+
+    void set_dest(c74::max::t_symbol* name) {
+        m_dest.store(name);
+    }
+
+
+    bool active() const {
+        auto source = m_source.read();
+        return source->buffer || source->file || m_dest.load();
+    }
+
+
+    // Transform `sequence`, or the source's steps, and write the result into the dest buffer, or
+    // pass it to `send(atoms)`. `length_of` and `transform` are as for send_batch. Returns the
+    // length of the output, or overflowed_length, with `problem` saying why, if it was too long to
+    // compute or a buffer couldn't be found or resized.
+    template<class length_function, class transform_function, class send_function>
+    size_t bang(c74::max::t_object* owner, const steps &sequence, length_function length_of, transform_function transform, send_function send, std::string &problem) {
+        auto                source = m_source.read();
+        c74::max::t_symbol* dest   = m_dest.load();
+
+        step_buffer::use read_use   { m_read };
+        step_buffer::use output_use { m_output };
+        steps&           read_seq   = *read_use;
+        steps&           output_seq = *output_use;
+
+        std::span<const int32_t> seq = sequence;
+        if (source->buffer) {
+            if (!read_buffer(owner, source->buffer, read_seq)) {
+                problem = "the source buffer~ couldn't be found";
+                return weft::overflowed_length;
+            }
+            seq = read_seq;
+        }
+        else if (source->file)
+            seq = source->file->lane(0);
+
+        size_t length = length_of(seq.size());
+        if (length == weft::overflowed_length) {
+            problem = "the transformed sequence is too long to compute, so it was not sent";
+            return weft::overflowed_length;
+        }
+        output_seq.resize(length);
+        transform(seq, std::span<int32_t>(output_seq));
+
+        if (!dest)
+            send(atoms(output_seq.begin(), output_seq.end()));
+        else if (!write_buffer(owner, dest, output_seq)) {
+            problem = "the dest buffer~ couldn't be found or resized";
+            return weft::overflowed_length;
+        }
+        return output_seq.size();
+    }
+
+
+    // Transform every lane of the source file, or else `sequence` or the source buffer's steps,
+    // and write the results to the .weft file `name`, as resolve_new_file finds it. Returns the
+    // number of lanes written, or 0, with `problem` saying why, if the file couldn't be written.
+    template<class length_function, class transform_function>
+    size_t write_file(c74::max::t_object* owner, const std::string &name, const steps &sequence, length_function length_of, transform_function transform, std::string &problem) {
+        std::string path;
+        if (!resolve_new_file(name, path)) {
+            problem = "couldn't write " + name + ": its folder couldn't be found";
+            return 0;
+        }
+
+        auto source = m_source.read();
+
+        step_buffer::use read_use   { m_read };
+        step_buffer::use output_use { m_output };
+        steps&           read_seq   = *read_use;
+        steps&           output_seq = *output_use;
+
+        weft::sequence_writer writer { path };
+        auto write_lane = [&](std::span<const int32_t> seq) {
+            size_t length = length_of(seq.size());
+            if (length == weft::overflowed_length)
+                return weft::file_status::too_long;
+
+            output_seq.resize(length);
+            transform(seq, std::span<int32_t>(output_seq));
+            return writer.write_lane(output_seq);
+        };
+
+        size_t            lanes  = 0;
+        weft::file_status status = weft::file_status::ok;
+        if (source->file) {
+            for (; lanes < source->file->lanes() && status == weft::file_status::ok; lanes++)
+                status = write_lane(source->file->lane(lanes));
+        }
+        else if (source->buffer) {
+            if (!read_buffer(owner, source->buffer, read_seq)) {
+                problem = "the source buffer~ couldn't be found";
+                return 0;
+            }
+            status = write_lane(read_seq);
+            lanes  = 1;
+        }
         else {
-            transformed_seq.push_back(seq[processed_step_index % seq.size()]);
-            processed_step_index++;
+            status = write_lane(sequence);
+            lanes  = 1;
+        }
+
+        if (status == weft::file_status::ok)
+            status = writer.finish();
+        if (status != weft::file_status::ok) {
+            problem = "couldn't write " + path + ": " + weft::describe(status);
+            return 0;
+        }
+        return lanes;
+    }
+
+private:
+    struct sequence_source {
+        c74::max::t_symbol*                        buffer {nullptr};
+        std::shared_ptr<const weft::sequence_file> file;
+    };
+
+    // A buffer~ looked up by name for the length of one bang.
+    class found_buffer {
+    public:
+        found_buffer(c74::max::t_object* owner, c74::max::t_symbol* name)
+        : m_reference { c74::max::buffer_ref_new(owner, name) }
+        {}
+
+        ~found_buffer() {
+            c74::max::object_free(m_reference);
         }
+
+        found_buffer(const found_buffer&) = delete;
+        found_buffer& operator=(const found_buffer&) = delete;
+
+        c74::max::t_buffer_obj* get() const {
+            return m_reference ? c74::max::buffer_ref_getobject(m_reference) : nullptr;
+        }
+
+    private:
+        c74::max::t_buffer_ref* m_reference;
+    };
+
+
+    static bool read_buffer(c74::max::t_object* owner, c74::max::t_symbol* name, steps &seq) {
+        using namespace c74::max;
+
+        found_buffer  found { owner, name };
+        t_buffer_obj* buffer  = found.get();
+        float*        samples = buffer ? buffer_locksamples(buffer) : nullptr;
+        if (!samples)
+            return false;
+
+        size_t frames   = size_t(buffer_getframecount(buffer));
+        size_t channels = size_t(buffer_getchannelcount(buffer));
+        seq.resize(frames);
+        for (size_t frame = 0; frame < frames; frame++)
+            seq[frame] = to_step(samples[frame * channels]);
+
+        buffer_unlocksamples(buffer);
+        return true;
     }
+
+
+    static bool write_buffer(c74::max::t_object* owner, c74::max::t_symbol* name, const steps &output) {
+        using namespace c74::max;
+
+        found_buffer  found { owner, name };
+        t_buffer_obj* buffer = found.get();
+        if (!buffer)
+            return false;
+
+        // Resizing reallocates the samples, so it happens before they are locked.
+        if (size_t(buffer_getframecount(buffer)) != output.size())
+            object_method_long(reinterpret_cast<t_object*>(buffer), gensym("sizeinsamps"), t_atom_long(output.size()), nullptr);
+
+        float* samples = buffer_locksamples(buffer);
+        if (!samples)
+            return false;
+
+        size_t frames   = size_t(buffer_getframecount(buffer));
+        size_t channels = size_t(buffer_getchannelcount(buffer));
+        if (frames != output.size()) {
+            buffer_unlocksamples(buffer);
+            return false;
+        }
+        for (size_t frame = 0; frame < frames; frame++)
+            std::fill_n(samples + frame * channels, channels, float(output[frame]));
+
+        buffer_unlocksamples(buffer);
+        buffer_setdirty(buffer);
+        return true;
+    }
+
+
+    // The nearest step to a sample, clamped to the range of a step.
+    static int32_t to_step(float sample) {
+        if (std::isnan(sample))
+            return 0;
+        return int32_t(std::clamp(std::round(double(sample)), double(INT32_MIN), double(INT32_MAX)));
+    }
+
+    snapshot<sequence_source>        m_source { sequence_source {} };
+    std::atomic<c74::max::t_symbol*> m_dest   { nullptr };
+
+    // The source buffer~'s steps and the transformed steps.
+    step_buffer                      m_read;
+    step_buffer                      m_output;
+};
+
+
+// The name traced for `what` on the object called `object_name`, kept for as long as Max runs.
+const char* traced_name(const char* object_name, const char* what) {
+    return c74::max::gensym((std::string(object_name) + " " + what).c_str())->s_name;
+}
+
+
+// The messages and attributes every sequence transformer handles the same way, whatever its
+// transform: batch, jit_matrix, read, write, @source and @dest, and the bangs they change. An
+// object derives from sequence_object<itself> in place of object<itself>, makes it a friend, and
+// has:
+//
+//     class_name                          its name in Max, for traces
+//     m_state                             a snapshot of its state, with the sequence in `sequence`
+//     output, output_mode, m_delta        the outlet its results leave by, and how they are sent
+//     transformed_length(state, seq_size) as send_batch's length_of, for that state
+//     transform_into(state, seq, out)     as send_batch's transform, for that state
+template<class owner_type>
+class sequence_object : public object<owner_type> {
+    // The buffer~s and file named by @source and @dest, if any.
+    sequence_io m_io;
+
+    // What the messages trace under, named once rather than on every call.
+    const char* m_batch_name      { traced_name(owner_type::class_name, "batch") };
+    const char* m_jit_matrix_name { traced_name(owner_type::class_name, "jit_matrix") };
+    const char* m_source_name     { traced_name(owner_type::class_name, "source") };
+    const char* m_dest_name       { traced_name(owner_type::class_name, "dest") };
+    const char* m_write_name      { traced_name(owner_type::class_name, "write") };
+
+    // The matrix the jit_matrix message sends out.
+    matrix_output m_matrix;
+
+public:
+    message<> batch { this, "batch", "Transform every sequence in the named dictionary with the current attributes, on every processor core, and send out a dictionary of the results under the same keys.",
+        MIN_FUNCTION {
+            trace_scope traced { m_batch_name };
+            auto current = owner().m_state.read();
+
+            if (args.size() == 0 || !send_batch(args[0], length_of(*current), transform_one(*current), owner().output))
+                this->cerr << "batch needs the name of a dictionary of sequences" << endl;
+            return {};
+        }
+    };
+
+
+    message<> dictionary { this, "dictionary", "Transform every sequence in a dictionary, as batch does.",
+        MIN_FUNCTION {
+            return batch(args);
+        }
+    };
+
+
+    message<> jit_matrix { this, "jit_matrix", "Transform every row of the named one-plane long matrix with the current attributes, on every processor core, and send out a matrix of the results, one row each.",
+        MIN_FUNCTION {
+            trace_scope traced { m_jit_matrix_name };
+            auto current = owner().m_state.read();
+
+            if (args.size() == 0 || !send_matrix(args[0], length_of(*current), transform_one(*current), m_matrix, owner().output))
+                this->cerr << "jit_matrix needs the name of a long matrix of one plane and one or two dimensions" << endl;
+            return {};
+        }
+    };
+
+
+    message<> read { this, "read", "Map a .weft file, given as a path or a name on Max's search path, and transform its first lane in place of the sequence, as @source file does.",
+        MIN_FUNCTION {
+            if (args.size() == 0)
+                this->cerr << "read needs the path of a .weft file" << endl;
+            else
+                source = atoms { "file", args[0] };
+            return {};
+        }
+    };
+
+
+    message<> write { this, "write", "Transform every lane of the .weft file read, or else the sequence, and write the results to a .weft file, given as a path or a name for Max's default folder. Any file already there is replaced only once the new one is complete.",
+        MIN_FUNCTION {
+            trace_scope traced { m_write_name };
+            if (args.size() == 0) {
+                this->cerr << "write needs the path of the file to write" << endl;
+                return {};
+            }
+
+            auto        current = owner().m_state.read();
+            std::string problem;
+            if (m_io.write_file(this->maxobj(), std::string(args[0]), *current->sequence, length_of(*current), transform_one(*current), problem) == 0)
+                this->cerr << problem << endl;
+            return {};
+        }
+    };
+
+
+    attribute< vector<symbol> > source { this, "source", {"list"},
+        description {"Where bang reads the sequence from: list, for the sequence attribute, buffer and the name of a buffer~, whose first channel holds the steps, or file and the path of a .weft file, whose first lane holds them."},
+        setter { MIN_FUNCTION {
+            trace_scope traced { m_source_name };
+            std::string problem;
+            if (!m_io.set_source(args, problem)) {
+                this->cerr << problem << endl;
+                return this->source;
+            }
+            return args;
+        }}
+    };
+
+
+    attribute< vector<symbol> > dest { this, "dest", {"list"},
+        description {"Where bang sends the transformed sequence: list, for the left outlet, or buffer and the name of a buffer~, which is resized to hold it in every channel."},
+        setter { MIN_FUNCTION {
+            trace_scope traced { m_dest_name };
+            c74::max::t_symbol* name;
+            if (!parse_buffer_target(args, name))
+                return this->dest;
+            m_io.set_dest(name);
+            return args;
+        }}
+    };
+
+
+protected:
+    // With @source or @dest set, transform the current state's sequence, or the source's steps, as
+    // sequence_io::bang does, and return true. Otherwise return false and leave the bang to the
+    // object.
+    template<class state_type>
+    bool bang_io(const state_type& current, bang_stats::scope& timing) {
+        if (!m_io.active())
+            return false;
+
+        owner_type& self = owner();
+        std::string problem;
+        size_t      sent = m_io.bang(this->maxobj(), *current.sequence, length_of(current), transform_one(current),
+            [&](const atoms& result) { send_output(self.output, result, self.output_mode, self.m_delta); }, problem);
+
+        if (sent == weft::overflowed_length)
+            this->cerr << problem << endl;
+        else
+            timing.output(sent);
+        return true;
+    }
+
+
+private:
+    owner_type& owner() {
+        return static_cast<owner_type&>(*this);
+    }
+
+    template<class state_type>
+    static auto length_of(const state_type& current) {
+        return [&current](size_t seq_size) { return owner_type::transformed_length(current, seq_size); };
+    }
+
+    template<class state_type>
+    static auto transform_one(const state_type& current) {
+        return [&current](std::span<const int32_t> seq, std::span<int32_t> out) { owner_type::transform_into(current, seq, out); };
+    }
+};
+
+
+// Asynchronous bang. With @async on, or set to auto and an output estimated at async_threshold
+// steps or more, bang hands the transform to the object's background worker and returns at once.
+// The result comes back through a timer, so it still leaves the outlet on the scheduler thread.
+enum class async_modes : int { off, on, automatic, enum_count };
+
+const enum_map async_modes_range = {"off", "on", "auto"};
+
+constexpr size_t async_threshold = 1 << 16;
+
+
+bool runs_async(async_modes mode, size_t estimated_length) {
+    return mode == async_modes::on || (mode == async_modes::automatic && estimated_length >= async_threshold);
+}
+
+
+// A background thread for one object, started by its first job. Jobs run one at a time in the
+// order they were submitted. A superseding job drops every job still waiting, any result not yet
+// taken, and the result of the job running when it arrives, which can't be interrupted. Finished
+// results queue up for the owner, who is told through `notify` and collects them with `take`.
+//
+// The owner calls `stop` from its destructor, before the members that its jobs and `notify` use
+// are destroyed.
+template<class result_type>
+class background_worker {
+public:
+    using job_function = std::function<result_type()>;
+
+    explicit background_worker(std::function<void()> notify)
+    : m_notify { std::move(notify) }
+    {}
+
+    background_worker(const background_worker&) = delete;
+    background_worker& operator=(const background_worker&) = delete;
+
+    ~background_worker() {
+        stop();
+    }
+
+
+    void submit(job_function job, bool supersede) {
+        std::lock_guard<std::mutex> lock {m_mutex};
+        if (m_stopping)
+            return;
+
+        if (supersede) {
+            m_waiting.clear();
+            m_finished.clear();
+            m_generation++;
+        }
+        m_waiting.push_back({ std::move(job), m_generation });
+
+        if (!m_thread.joinable())
+            m_thread = std::thread([this] { work(); });
+        m_wake.notify_one();
+    }
+
+
+    // The oldest finished result, or nothing if there is none.
+    std::optional<result_type> take() {
+        std::lock_guard<std::mutex> lock {m_mutex};
+        if (m_finished.empty())
+            return std::nullopt;
+
+        std::optional<result_type> result { std::move(m_finished.front()) };
+        m_finished.pop_front();
+        return result;
+    }
+
+
+    // Drop every waiting job and wait for the running one, if any, to finish.
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock {m_mutex};
+            m_stopping = true;
+            m_waiting.clear();
+        }
+        m_wake.notify_one();
+        if (m_thread.joinable())
+            m_thread.join();
+    }
+
+private:
+    struct job {
+        job_function run;
+        size_t       generation;
+    };
+
+
+    void work() {
+        while (true) {
+            job next;
+            {
+                std::unique_lock<std::mutex> lock {m_mutex};
+                m_wake.wait(lock, [this] { return m_stopping || !m_waiting.empty(); });
+                if (m_stopping)
+                    return;
+
+                next = std::move(m_waiting.front());
+                m_waiting.pop_front();
+            }
+
+            std::optional<result_type> result;
+            {
+                trace_scope traced { "weft background job" };
+                result.emplace(next.run());
+            }
+            {
+                std::lock_guard<std::mutex> lock {m_mutex};
+                if (m_stopping || next.generation != m_generation)
+                    continue;
+                m_finished.push_back(std::move(*result));
+            }
+            m_notify();
+        }
+    }
+
+
+    std::function<void()>   m_notify;
+    std::mutex              m_mutex;
+    std::condition_variable m_wake;
+    std::deque<job>         m_waiting;
+    std::deque<result_type> m_finished;
+    size_t                  m_generation { 0 };
+    bool                    m_stopping   { false };
+    std::thread             m_thread;
+};
+
+
+// What an async bang's job hands back: the state it read, whose output it has computed and cached,
+// and the bang, still to be recorded when that output is sent.
+template<class state_type>
+struct async_result {
+    typename snapshot<state_type>::reader current;
+    bang_stats::pending                   timing;
+};
+
+
+// Step-by-step playback. Indices and the cursor are as wide as Max's integers, since outputs can
+// be longer than an int counts.
+using step_index = c74::max::t_atom_long;
+
+enum class play_result { played, empty, too_long };
+
+
+// Wrap `index` into the stepper's output (negative indices count back from the end), move the
+// cursor past it and return the step there. An output too long to count has no end to wrap at,
+// so nothing is played from it.
+template<class stepper_type, class cursor_type>
+play_result play_step(const stepper_type &stepper, step_index index, cursor_type &cursor, int32_t &value) {
+    size_t length = stepper.length();
+    if (length == 0)
+        return play_result::empty;
+    if (length == weft::overflowed_length)
+        return play_result::too_long;
+
+    size_t position = index >= 0 ? size_t(index) % length : length - 1 - size_t(-(index + 1)) % length;
+    value  = stepper.at(position);
+    cursor = step_index((position + 1) % length);
+    return play_result::played;
+}
+
+
+// Signal-rate playback. The input signal is either a step index or a phasor, which plays the whole
+// output once per cycle. Either wraps into the output, so an index counting past its end loops.
+enum class signal_input { index, phasor };
+
+
+signal_input to_signal_input(const symbol &input) {
+    return input == symbol("phasor") ? signal_input::phasor : signal_input::index;
+}
+
+
+// Return the step of the stepper's output at the input sample. Allocation and lock free, so it
+// can be called from the audio thread. Returns 0 for an empty output or a non-finite input.
+template<class stepper_type>
+sample signal_step(const stepper_type &stepper, sample input, signal_input mode) {
+    size_t length = stepper.length();
+    if (length == 0 || !std::isfinite(input))
+        return 0.0;
+
+    double position = mode == signal_input::phasor ? (input - std::floor(input)) * length : std::floor(input);
+    double wrapped  = position - std::floor(position / length) * length;
+    return stepper.at(std::min(size_t(wrapped), length - 1));
 }
@@ -165,5 +165,40 @@ SCENARIO("object produces correct output") {
                 REQUIRE(output[0] == expected);
             }
         }
+
+        WHEN("a shift sequence is provided and it is stepped through with 'next'") {
+            atoms shift_seq = { 1, 0 };
+            my_object.shift_pattern = shift_seq;
+            for (int i = 0; i < 5; i++)
+                my_object.next();
+
+            THEN("each step is shifted and the cursor wraps around to the start") {
+                auto& output = *c74::max::object_getoutput(my_object, 0);
+                REQUIRE(output.size() == 5);
+                REQUIRE(output[0] == atoms{2});
+                REQUIRE(output[1] == atoms{2});
+                REQUIRE(output[2] == atoms{4});
+                REQUIRE(output[3] == atoms{4});
+                REQUIRE(output[4] == atoms{2});
+            }
+        }
+
+        WHEN("it is banged and then single steps of the sequence and shift pattern are edited") {
+            atoms sequence  = {1, 2, 0, 4, 5};
+            atoms shift_seq = {1, 0};
+            my_object.sequence = sequence;
+            my_object.shift_pattern = shift_seq;
+            my_object.bang();
+            my_object.setstep({2, 3});
+            my_object.setpattern({1, 10});
+            my_object.bang();
+
+            THEN("the next bang sends out the shifted sequence with the edits applied") {
+                auto& output = *c74::max::object_getoutput(my_object, 0);
+                atoms expected = {2, 12, 4, 14, 6};
+                REQUIRE(output.size() == 2);
+                REQUIRE(output[1] == expected);
+            }
+        }
     }
 }